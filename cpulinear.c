@@ -1,19 +1,46 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <sys/time.h>
 #include <math.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <signal.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <GLES3/gl3.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "libcpulinear.h"
 
 #include "256-1.h"
 #include "256-2.h"
@@ -25,28 +52,389 @@
 #include "512-3.h"
 #include "512-4.h"
 
-GLubyte *textures[4];
+GLubyte *images[4];
+GLubyte **textures = images;
+int num_textures = 4;
 
 int width = 256;
 int height = 256;
 
 Display    *x_display;
-Window      win;
 EGLDisplay  egl_display;
-EGLContext  egl_context;
-EGLSurface  egl_surface;
+EGLConfig   egl_config;
+
+// a window (or pbuffer) with its own context, program and upload stream
+struct surface {
+	Window      win;
+	EGLSurface  egl_surface;
+	EGLContext  egl_context;
+
+	struct cpl_quad quad;
+	struct cpl_upload up;
+	GLint uv_sampler_loc;
 
-GLint position_loc;
-GLint texture_loc;
-GLint sampler_loc;
+	GLuint texture_id;
+	GLuint uv_texture_id;
+
+	int donesetup;
+	int source_index;
+	float upload_dt;
+	unsigned int upload_size;
+	unsigned int frames;
+
+	// never reset, for the end of run totals
+	unsigned long long total_frames;
+	double total_upload;
+	double total_upload_dt;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+};
 
-GLuint texture_id;
+struct surface *surfaces = NULL;
+int num_surfaces = 1;
+int surface_threads = 0;
+int surface_pbuffer = 0;
+atomic_bool surfaces_quit;
 
 bool update_pos = false;
-float upload_dt = 0.;
-unsigned int upload_size = 0;
 int upload = 0;
 int fillrate = 0;
+int gles_version = 2;
+
+size_t source_pool_bytes = 0;
+int cache_flush = 0;
+int numa_node = -1;
+
+const char *source_file = NULL;
+int source_populate = 0;
+int source_readahead = 0;
+GLubyte *source_map = NULL;
+size_t source_map_size = 0;
+float fault_dt = 0.;
+long minor_faults = 0;
+long major_faults = 0;
+
+enum source_format {
+	FORMAT_RGBA,
+	FORMAT_NV12,            // full-res Y plane followed by interleaved half-res UV
+};
+
+enum source_format source_format = FORMAT_RGBA;
+size_t frame_bytes = 0;
+
+// source rows are src_stride bytes apart, like padded decoder output
+int stride_pad = 0;
+int stride_align = 1;
+int src_stride = 0;
+int unpack_alignment = 1;
+bool unpack_alignment_given = false;
+
+// how rgba frames get into the texture, picked from the stride unless given
+const struct cpl_upload_strategy *upload_strategy = NULL;
+int pbo_depth = 0;
+const char *upload_profile = NULL;
+
+// how repack and pbo stage frames, "all" measures every kernel first
+const struct cpl_copy_kernel *copy_kernel = NULL;
+bool copy_kernel_all = false;
+
+#define COPY_KERNEL_TIME 0.2
+
+int verify = 0;
+
+int map_probe = 0;
+
+#define MAP_PROBE_TIME 0.2
+
+// pixel operation throughput on one mapping, MiB/s
+struct map_rates {
+	double seq_write;
+	double random_write;
+	double read;
+	double rmw;
+};
+
+uint64_t map_probe_sink;
+
+// allowed per channel difference from the reference image
+#define VERIFY_TOLERANCE_GL 0           // same sampler, same texels
+#define VERIFY_TOLERANCE_CPU_NEAREST 0
+#define VERIFY_TOLERANCE_CPU_LINEAR 3   // two truncating 8 bit lerps
+
+int autotune = 0;
+double autotune_budget = 10.;
+const char *autotune_output = "cpulinear.profile";
+
+#define MAX_CPUS 256
+
+int helper_cpus[MAX_CPUS];
+int num_helper_cpus = 0;
+int render_cpu = -1;
+int sched_fifo_prio = 0;
+
+struct cpufreq_state {
+	int cpu;
+	char governor[32];
+	long khz;
+	bool warned;
+};
+
+struct cpufreq_state freq_start[MAX_CPUS];
+int num_freq = 0;
+bool freq_changed = false;
+
+#define MAX_ENERGY_SENSORS 16
+
+// a powercap zone or hwmon channel, either a µJ counter or a µW reading
+// that gets integrated over the interval
+struct energy_sensor {
+	char path[300];
+	char name[64];
+	bool power;
+	double range;           // µJ at which the counter wraps, 0 if unknown
+	double last;
+};
+
+int calibrate = 0;
+int calibrate_threads = 0;
+
+// copy bandwidth with the source frame layout, MiB/s
+double memcpy_ceiling = 0.;
+double memcpy_ceiling_mt = 0.;
+
+#define CALIBRATE_TIME 0.3
+
+enum bw_kernel {
+	BW_MEMCPY,
+	BW_NT_COPY,
+	BW_READ,
+	BW_WRITE,
+	NUM_BW_KERNELS
+};
+
+const char *bw_kernel_names[] = { "memcpy", "nt copy", "read", "write" };
+
+int energy = 0;
+struct energy_sensor energy_sensors[MAX_ENERGY_SENSORS];
+int num_energy_sensors = 0;
+double energy_last_t;
+
+volatile sig_atomic_t interrupted = 0;
+
+enum renderer {
+	RENDERER_GL,
+	RENDERER_CPU,           // software reference for the textured quad
+};
+
+enum renderer renderer = RENDERER_GL;
+
+enum present {
+	PRESENT_GL,             // eglSwapBuffers
+	PRESENT_XSHM,           // XShmPutImage of CPU produced frames, no GLES at all,
+				// XPutImage when the server cannot share memory
+};
+
+enum present present = PRESENT_GL;
+
+#define XSHM_BUFFERS 2
+
+struct shm_buffer {
+	XImage *image;
+	XShmSegmentInfo info;
+	bool shm;               // false for the XPutImage fallback
+	bool busy;              // until the server sends ShmCompletion
+};
+GLint filter = GL_NEAREST;
+
+enum readback {
+	READBACK_NONE,
+	READBACK_SYNC,          // glReadPixels into client memory
+	READBACK_PBO,           // glReadPixels into a ring of pack buffers, fenced
+};
+
+enum readback readback = READBACK_NONE;
+int readback_native = 0;
+int readback_depth = 3;
+GLenum read_format = GL_RGBA;
+GLenum read_type = GL_UNSIGNED_BYTE;
+int read_bpp = 4;
+GLubyte *readback_buf = NULL;
+GLuint *readback_pbos = NULL;
+GLsync *readback_fences = NULL;
+double *readback_issued = NULL;
+unsigned int readback_frame = 0;
+float readback_dt = 0.;
+unsigned int readback_size = 0;
+double latency_sum = 0., latency_min = 0., latency_max = 0.;
+unsigned int latency_count = 0;
+
+struct rect {
+	int x, y, w, h;
+};
+
+// partial updates: K random rects per frame, or frames from a script
+int dirty_rects = 0;
+float dirty_fraction = 0.1;
+const char *dirty_script = NULL;
+int dirty_repack = 0;
+struct rect *script_rects = NULL;
+int *script_frames = NULL;      // index of each frame's first rect, plus end
+int num_script_frames = 0;
+GLubyte *repack_buf = NULL;
+
+// least squares fit of time per call against bytes per call
+double fit_n, fit_b, fit_t, fit_bb, fit_bt;
+double full_dt = 0.;
+unsigned int full_count = 0;
+
+#define FULL_UPLOAD_EVERY 100
+
+// damage-aware presentation: a band of damage_fraction of the surface
+// height moves down the window, every other report interval swaps the
+// full surface for comparison
+float damage_fraction = 0.;
+PFNEGLSETDAMAGEREGIONKHRPROC set_damage_region = NULL;
+PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_with_damage = NULL;
+const char *damage_method = "full swap";
+bool damage_full_phase = false;
+EGLint damage_rect[4];
+float swap_dt = 0.;
+unsigned int swaps = 0;
+long buffer_age_sum = 0;
+
+// frame pacing: timestamps around every swap, present times from
+// EGL_ANDROID_get_frame_timestamps or, lacking that, fences that tell
+// when the GPU finished each frame
+int swap_interval = 0;
+bool pacing = false;
+PFNEGLGETNEXTFRAMEIDANDROIDPROC get_next_frame_id = NULL;
+PFNEGLGETFRAMETIMESTAMPSANDROIDPROC get_frame_timestamps = NULL;
+
+#define MAX_PACE_SAMPLES 4096
+#define MAX_PENDING 16
+
+struct pending_frame {
+	EGLuint64KHR id;
+	GLsync fence;
+	double swapped;
+};
+
+double pace_intervals[MAX_PACE_SAMPLES];
+double pace_swap_calls[MAX_PACE_SAMPLES];
+int num_pace = 0;
+double last_swap = 0.;
+struct pending_frame pending[MAX_PENDING];
+int num_pending = 0;
+double present_latency_sum = 0.;
+unsigned int present_latency_count = 0;
+long queue_depth_sum = 0;
+int queue_depth_max = 0;
+unsigned int queue_samples = 0;
+
+// GPU side timing of the upload and the draw, a ring of query objects
+// is read GPU_QUERY_RING frames later so the reads never stall
+int gpu_timing = 0;
+PFNGLGENQUERIESEXTPROC gen_queries = NULL;
+PFNGLBEGINQUERYEXTPROC begin_query = NULL;
+PFNGLENDQUERYEXTPROC end_query = NULL;
+PFNGLGETQUERYOBJECTUIVEXTPROC get_query_uiv = NULL;
+PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_ui64v = NULL;
+
+enum gpu_phase {
+	GPU_UPLOAD,
+	GPU_DRAW,
+	GPU_PHASES
+};
+
+#define GPU_QUERY_RING 8
+
+struct gpu_frame {
+	GLuint queries[GPU_PHASES];
+	bool issued[GPU_PHASES];
+};
+
+struct gpu_frame gpu_frames[GPU_QUERY_RING];
+struct gpu_frame *gpu_current = NULL;
+double gpu_time[GPU_PHASES];
+unsigned int gpu_samples[GPU_PHASES];
+unsigned int gpu_dropped = 0;
+
+#define SURFACE_REPORT_INTERVAL 2.0
+
+int num_processes = 1;
+int duration = 0;
+double run_start;
+
+// what a --processes worker hands back to the parent
+struct worker_result {
+	pid_t pid;
+	unsigned long long frames;
+	double upload_bytes;
+	double upload_time;     // inside the upload calls, as upload_dt
+	double elapsed;
+};
+
+// shared mapping set up by the parent before forking
+struct worker_shared {
+	pthread_barrier_t barrier;
+	atomic_int started;
+	struct worker_result results[];
+};
+
+struct worker_shared *workers = NULL;
+struct worker_result *worker_result = NULL;
+
+#define BLIT_TILE 64
+
+// the quad as an affine map from output pixel to texel, in 16.16 fixed point
+int32_t blit_s0, blit_t0;
+int32_t blit_dsdx, blit_dtdx, blit_dsdy, blit_dtdy;
+GLubyte *blit_dst = NULL;
+int blit_stride = 0;
+const GLubyte *blit_src = NULL;
+int blit_threads = 1;
+pthread_t *blit_workers = NULL;
+pthread_barrier_t blit_start, blit_done;
+atomic_int blit_next_tile;
+bool blit_quit = false;
+bool blit_swap_rb = false;
+
+// a producer thread hands frames to the render thread through its own
+// single-producer/single-consumer ring of source buffers
+struct producer {
+	pthread_t thread;
+	int index;
+	GLubyte **slots;
+	unsigned int depth;
+	atomic_uint head;       // frames published by the producer
+	atomic_uint tail;       // frames released by the render thread
+	atomic_ullong bytes;    // bytes written since the last report
+};
+
+struct producer *producers = NULL;
+int num_producers = 0;
+unsigned int producer_depth = 2;
+atomic_bool producers_quit = false;
+float stall_dt = 0.;
+unsigned int stalls = 0;
+enum source_alloc {
+	ALLOC_STATIC,           // the GIMP arrays, wherever the linker put them
+	ALLOC_MALLOC,
+	ALLOC_ALIGN64,
+	ALLOC_ALIGN4K,
+	ALLOC_HUGETLB,
+	ALLOC_THP,
+};
+
+const char *source_alloc_names[] = {
+	"static", "malloc", "align64", "align4k", "hugetlb", "thp"
+};
+
+enum source_alloc source_alloc = ALLOC_STATIC;
+
+size_t llc_size = 0;
+size_t cache_line = 64;
 
 GLfloat vertexArray[] = {
 	-1.0, -1.0,  0.0, // bottom left
@@ -103,375 +491,4187 @@ GLfloat vertexArray270[] = {
 GLfloat *vtx = &vertexArray[0];
 GLfloat *tex = &vertexArray[3];
 
-const char vertex_src[] =
-	"attribute vec4 a_position;   \n"
-	"attribute vec2 a_texCoord;   \n"
-	"varying vec2 v_texCoord;     \n"
-	"void main()                  \n"
-	"{                            \n"
-	"   gl_Position = a_position; \n"
-	"   v_texCoord = a_texCoord;  \n"
-	"}                            \n";
+// BT.601 limited range, Y in s_texture and UV as luminance/alpha in s_uv
+const char fragment_nv12_src[] =
+	"precision mediump float;                                   \n"
+	"varying vec2 v_texCoord;                                   \n"
+	"uniform sampler2D s_texture;                               \n"
+	"uniform sampler2D s_uv;                                    \n"
+	"void main()                                                \n"
+	"{                                                          \n"
+	"  float y = 1.1643 * (texture2D(s_texture, v_texCoord).r - 0.0625);\n"
+	"  vec2 uv = texture2D(s_uv, v_texCoord).ra - 0.5;          \n"
+	"  gl_FragColor = vec4(y + 1.5958 * uv.y,                   \n"
+	"                      y - 0.39173 * uv.x - 0.81290 * uv.y, \n"
+	"                      y + 2.017 * uv.x,                    \n"
+	"                      1.0);                                \n"
+	"}                                                          \n";
 
-const char fragment_src[] =
-	"precision mediump float;                            \n"
-	"varying vec2 v_texCoord;                            \n"
-	"uniform sampler2D s_texture;                        \n"
-	"void main()                                         \n"
-	"{                                                   \n"
-	"  gl_FragColor = texture2D(s_texture, v_texCoord);  \n"
-	"}                                                   \n";
+// fragment stages for rgba sources standing in for real work, each samples
+// s_texture at v_texCoord
+struct shader_variant {
+	const char *name;
+	const char *src;        // NULL for cpl_fragment_src, a plain mediump fetch
+};
 
-void print_shader_info_log(GLuint shader)
-{
-	GLint length;
-	GLint success;
+const struct shader_variant shader_variants[] = {
+	{ "mediump", NULL },
+	{ "highp",
+	  "precision highp float;                              \n"
+	  "varying vec2 v_texCoord;                            \n"
+	  "uniform sampler2D s_texture;                        \n"
+	  "void main()                                         \n"
+	  "{                                                   \n"
+	  "  gl_FragColor = texture2D(s_texture, v_texCoord);  \n"
+	  "}                                                   \n" },
+	// color conversion, 16 multiply-adds per pixel
+	{ "color-matrix",
+	  "precision mediump float;                            \n"
+	  "varying vec2 v_texCoord;                            \n"
+	  "uniform sampler2D s_texture;                        \n"
+	  "uniform mat4 u_matrix;                              \n"
+	  "uniform vec4 u_offset;                              \n"
+	  "void main()                                         \n"
+	  "{                                                   \n"
+	  "  gl_FragColor = u_matrix * texture2D(s_texture, v_texCoord) + u_offset;\n"
+	  "}                                                   \n" },
+	// five texture fetches, as a sharpening or scaling filter does
+	{ "multi-tap",
+	  "precision mediump float;                            \n"
+	  "varying vec2 v_texCoord;                            \n"
+	  "uniform sampler2D s_texture;                        \n"
+	  "uniform vec2 u_texel;                               \n"
+	  "void main()                                         \n"
+	  "{                                                   \n"
+	  "  vec4 c = texture2D(s_texture, v_texCoord) * 0.5;  \n"
+	  "  c += texture2D(s_texture, v_texCoord - vec2(u_texel.x, 0.0)) * 0.125;\n"
+	  "  c += texture2D(s_texture, v_texCoord + vec2(u_texel.x, 0.0)) * 0.125;\n"
+	  "  c += texture2D(s_texture, v_texCoord - vec2(0.0, u_texel.y)) * 0.125;\n"
+	  "  c += texture2D(s_texture, v_texCoord + vec2(0.0, u_texel.y)) * 0.125;\n"
+	  "  gl_FragColor = c;                                 \n"
+	  "}                                                   \n" },
+	{ "premultiply",
+	  "precision mediump float;                            \n"
+	  "varying vec2 v_texCoord;                            \n"
+	  "uniform sampler2D s_texture;                        \n"
+	  "void main()                                         \n"
+	  "{                                                   \n"
+	  "  vec4 c = texture2D(s_texture, v_texCoord);        \n"
+	  "  gl_FragColor = vec4(c.rgb * c.a, c.a);            \n"
+	  "}                                                   \n" },
+	{ NULL, NULL }
+};
 
-	glGetShaderiv(shader ,GL_INFO_LOG_LENGTH, &length);
+const struct shader_variant *shader = &shader_variants[0];
+bool shader_all = false;
 
-	if (length > 1) {
-		char *buffer = (char *)malloc(length);
-		glGetShaderInfoLog (shader, length , NULL, buffer);
-		printf("%s\n", buffer);
-		free(buffer);
-	}
+// directory of linked program binaries, NULL compiles every time
+const char *program_cache = NULL;
 
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-	if (success != GL_TRUE) {
-		fprintf(stderr, "Error compiling shader\n");
-		exit(1);
-	}
-}
+const char *const program_source_names[] = {
+	[CPL_PROGRAM_COMPILED] = "compiled",
+	[CPL_PROGRAM_CACHED] = "cold start, compiled and cached",
+	[CPL_PROGRAM_LOADED] = "warm start, loaded from cache",
+	[CPL_PROGRAM_UNCACHEABLE] = "compiled, not cacheable on this driver",
+};
 
+int startup = 0;
 
-GLuint load_shader(const char *shader_source, GLenum type)
-{
-	GLuint shader = glCreateShader(type);
+#define MAX_STARTUP_STEPS 16
+#define WATERFALL_WIDTH 40
 
-	glShaderSource(shader, 1, &shader_source, NULL);
-	glCompileShader(shader);
+// one step on the way to the first frame, seconds since main() started
+struct startup_step {
+	const char *name;
+	double start;
+	double end;
+};
 
-	print_shader_info_log(shader);
+struct startup_step startup_steps[MAX_STARTUP_STEPS];
+int num_startup_steps = 0;
+double startup_t0;
+bool startup_done = false;
 
-	return shader;
-}
+#define SHADER_TIME 2.0
 
-GLuint upload_texture(void)
+size_t parse_size(const char *arg)
 {
-   // Texture object handle
-   GLuint textureId;
-
-   // Use tightly packed data
-   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	char *end;
+	double size = strtod(arg, &end);
 
-   // Generate a texture object
-   glGenTextures(1, &textureId);
+	switch (*end) {
+	case 'g': case 'G':
+		size *= 1024.;
+		// fall through
+	case 'm': case 'M':
+		size *= 1024.;
+		// fall through
+	case 'k': case 'K':
+		size *= 1024.;
+		break;
+	case '\0':
+		break;
+	default:
+		return 0;
+	}
 
-   // Bind the texture object
-   glBindTexture(GL_TEXTURE_2D, textureId);
+	return size > 0 ? (size_t)size : 0;
+}
 
-   // Load the texture
-   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-		textures[0]);
+// reads the first line of a sysfs attribute, without the newline
+bool read_sysfs(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
 
-   // Set the filtering mode
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	if (f == NULL)
+		return false;
+	if (fgets(buf, len, f) == NULL)
+		buf[0] = '\0';
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
 
-   return textureId;
+	return true;
 }
 
-void render(void)
+// reads a sysfs cache attribute such as "32K" or "64"
+size_t read_cache_attr(const char *dir, const char *attr)
 {
-	static int donesetup = 0;
-	static XWindowAttributes gwa;
+	char path[512], buf[64];
 
-	// draw
-	if (!donesetup) {
-		XWindowAttributes gwa;
-		XGetWindowAttributes(x_display, win, &gwa);
-		glViewport(0, 0, gwa.width, gwa.height);
-		glClearColor(0.08, 0.06, 0.07, 1.);    // background color
-		donesetup = 1;
-	}
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	if (!read_sysfs(path, buf, sizeof(buf)))
+		return 0;
 
-	glVertexAttribPointer(position_loc, 3, GL_FLOAT, GL_FALSE,
-			      5 * sizeof (GLfloat), vtx);
-	glEnableVertexAttribArray(position_loc);
+	return parse_size(buf);
+}
 
-	glVertexAttribPointer(texture_loc, 2, GL_FLOAT, GL_FALSE,
-			      5 * sizeof (GLfloat), tex);
-	glEnableVertexAttribArray(texture_loc);
+void detect_caches(void)
+{
+	const char *base = "/sys/devices/system/cpu/cpu0/cache";
+	size_t best_level = 0;
+	struct dirent *de;
+	DIR *dir;
 
-	// Bind the texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture_id);
+	dir = opendir(base);
+	while (dir && (de = readdir(dir)) != NULL) {
+		char index[512], path[512], type[64];
+		size_t level, size, line;
 
-	if (upload) {
-		static int i=0;
-		struct timezone tz;
-		static struct timeval t1, t2;
+		if (strncmp(de->d_name, "index", 5) != 0)
+			continue;
+		snprintf(index, sizeof(index), "%s/%s", base, de->d_name);
 
-		gettimeofday(&t1, &tz);
+		// the instruction cache never holds source pixels
+		snprintf(path, sizeof(path), "%s/type", index);
+		if (read_sysfs(path, type, sizeof(type)) &&
+		    strcmp(type, "Instruction") == 0)
+			continue;
 
-		// Load the texture
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-			     textures[i]);
-		gettimeofday(&t2, &tz);
-		upload_dt += t2.tv_sec - t1.tv_sec + (t2.tv_usec - t1.tv_usec) * 1e-6;
-		upload_size += width * height * 4;
+		level = read_cache_attr(index, "level");
+		size = read_cache_attr(index, "size");
+		line = read_cache_attr(index, "coherency_line_size");
+		if (level > best_level && size > 0) {
+			best_level = level;
+			llc_size = size;
+		}
+		if (line > 0)
+			cache_line = line;
+	}
+	if (dir)
+		closedir(dir);
 
-		i++;
-		i = i % 4;
+	if (llc_size == 0) {
+		long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+		if (size <= 0)
+			size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+		if (size <= 0) {
+			fprintf(stderr, "unable to detect the last-level cache size, assuming 8 MiB\n");
+			size = 8 * 1024 * 1024;
+		}
+		llc_size = size;
 	}
+}
 
-	// Set the sampler texture unit to 0
-	glUniform1i(sampler_loc, 0);
+// push a source frame out of every cache level so that the next upload
+// has to fetch it from memory, the way a frame freshly written by DMA would
+void flush_source(const GLubyte *data, size_t len)
+{
+	size_t off;
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 5);
+#if defined(__x86_64__) || defined(__i386__)
+	for (off = 0; off < len; off += cache_line)
+		__builtin_ia32_clflush(data + off);
+	__builtin_ia32_mfence();
+#elif defined(__aarch64__)
+	for (off = 0; off < len; off += cache_line)
+		__asm__ volatile("dc civac, %0" : : "r" (data + off) : "memory");
+	__asm__ volatile("dsb sy" : : : "memory");
+#else
+	// no user space cache maintenance, evict by streaming through a
+	// scratch buffer twice the size of the last-level cache
+	static volatile GLubyte *scratch = NULL;
+	static GLubyte val = 0;
 
-	// get the rendered buffer to the screen
-	eglSwapBuffers(egl_display, egl_surface);
+	(void)data;
+	(void)len;
+	if (scratch == NULL) {
+		scratch = malloc(2 * llc_size);
+		if (scratch == NULL) {
+			fprintf(stderr, "unable to allocate cache flush buffer\n");
+			exit(1);
+		}
+	}
+	val++;
+	for (off = 0; off < 2 * llc_size; off += cache_line)
+		scratch[off] = val;
+#endif
 }
 
+size_t huge_page_size(void)
+{
+	char line[128];
+	size_t size = 2 * 1024 * 1024;
+	FILE *f = fopen("/proc/meminfo", "r");
 
-/////////////////////////////////////////////////////////////////////
+	while (f && fgets(line, sizeof(line), f)) {
+		unsigned long kb;
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+			size = kb * 1024;
+			break;
+		}
+	}
+	if (f)
+		fclose(f);
 
+	return size;
+}
 
-int main(int argc, char **argv)
+// how much of the mapping that contains addr is backed by transparent huge pages
+size_t thp_backed_bytes(const void *addr)
 {
-	int c;
-	int help = 0;
+	char line[256];
+	unsigned long start, end, kb;
+	bool found = false;
+	size_t bytes = 0;
+	FILE *f = fopen("/proc/self/smaps", "r");
 
-	while (1) {
-		int option_index = 0;
-		struct option long_options[] = {
-			{"help",     no_argument,       &help,      1 },
-			{"upload",   no_argument,       &upload,    1 },
-			{"fillrate", no_argument,       &fillrate,  1 },
-			{"rotate",   required_argument, 0,          0 },
-			{"size",     required_argument, 0,          0 },
-			{0,          0,                 0,          0 }
-		};
+	while (f && fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+			found = (unsigned long)addr >= start && (unsigned long)addr < end;
+		else if (found && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+			bytes += kb * 1024;
+	}
+	if (f)
+		fclose(f);
 
-		c = getopt_long_only(argc, argv, "", long_options,
-				     &option_index);
-		if (c == -1)
-			break;
+	return bytes;
+}
 
-		switch (c) {
-		case 0:
-			if (strcmp(long_options[option_index].name, "rotate") == 0) {
-				int rot = atoi(optarg);
-				switch(rot) {
-				case 90:
-					vtx = &vertexArray90[0];
-					tex = &vertexArray90[3];
-					break;
-				case 180:
-					vtx = &vertexArray180[0];
-					tex = &vertexArray180[3];
-					break;
-				case 270:
-					vtx = &vertexArray270[0];
-					tex = &vertexArray270[3];
-					break;
-				default:
-					printf("invalid rotation, must be one of: 90, 180, 270\n");
-					exit(1);
-					break;
-				}
-			}
-			else if (strcmp(long_options[option_index].name, "size") == 0) {
-				int size = atoi(optarg);
-				switch(size) {
-				case 256:
-				case 512:
-					width = height = size;
-					break;
-				default:
-					printf("invalid size, must be one of: 256, 512\n");
-					exit(1);
-					break;
-				}
-			}
-			break;
+// bind the page aligned part of [addr, addr + size) to numa_node
+void bind_numa(void *addr, size_t size)
+{
+	const unsigned long mpol_bind = 2, mpol_mf_move = 1 << 1;
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = ((unsigned long)addr + page - 1) & ~(page - 1);
+	unsigned long end = ((unsigned long)addr + size) & ~(page - 1);
+	unsigned long nodemask[16] = { 0 };
+	int bits = 8 * sizeof(nodemask[0]);
 
-		case '?':
-			help = 1;
-			break;
+	if (numa_node >= (int)(bits * 16)) {
+		fprintf(stderr, "numa node %d out of range\n", numa_node);
+		exit(1);
+	}
+	nodemask[numa_node / bits] = 1UL << (numa_node % bits);
 
-		default:
-			printf("?? getopt returned character code 0%o ??\n", c);
-		}
+	if (end <= start)
+		return;
+	if (syscall(SYS_mbind, start, end - start, mpol_bind, nodemask,
+		    bits * 16, mpol_mf_move) != 0) {
+		perror("mbind");
+		exit(1);
 	}
+}
 
-	if (help || (fillrate ^ upload == 0)) {
-		printf("usage: %s: [ --rotate 90|180|270 ] [ --size 256|512 ] [--fillrate|--upload]\n", basename(argv[0]));
-		exit(0);
+GLubyte *alloc_source(size_t size)
+{
+	void *ptr = NULL;
+	size_t huge;
+	GLubyte *base;
+
+	switch (source_alloc) {
+	case ALLOC_STATIC:
+	case ALLOC_MALLOC:
+		ptr = malloc(size);
+		break;
+	case ALLOC_ALIGN64:
+		if (posix_memalign(&ptr, 64, size) != 0)
+			ptr = NULL;
+		break;
+	case ALLOC_ALIGN4K:
+		if (posix_memalign(&ptr, 4096, size) != 0)
+			ptr = NULL;
+		break;
+	case ALLOC_HUGETLB:
+		huge = huge_page_size();
+		size = (size + huge - 1) & ~(huge - 1);
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr == MAP_FAILED) {
+			perror("mmap(MAP_HUGETLB)");
+			fprintf(stderr, "reserve huge pages via /proc/sys/vm/nr_hugepages\n");
+			exit(1);
+		}
+		break;
+	case ALLOC_THP:
+		// over-allocate so the buffer can start on a huge page boundary
+		huge = huge_page_size();
+		size = (size + huge - 1) & ~(huge - 1);
+		base = mmap(NULL, size + huge, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+		ptr = (void *)(((unsigned long)base + huge - 1) & ~(huge - 1));
+		if (madvise(ptr, size, MADV_HUGEPAGE) != 0)
+			perror("madvise(MADV_HUGEPAGE)");
+		break;
 	}
 
-	// open the standard display (the primary screen)
-	x_display = XOpenDisplay(NULL);
-	if (x_display == NULL) {
-		fprintf(stderr, "cannot connect to X server\n");
-		return 1;
+	if (ptr == NULL) {
+		fprintf(stderr, "unable to allocate %zu bytes of source memory\n", size);
+		exit(1);
 	}
 
-	// get the root window (usually the whole screen)
-	Window root = DefaultRootWindow(x_display);
+	if (numa_node >= 0)
+		bind_numa(ptr, size);
 
-	XSetWindowAttributes swa;
-	swa.event_mask = ExposureMask | KeyPressMask;
+	return ptr;
+}
 
-	// create a window with the provided parameters
-	win = XCreateWindow (
-		x_display, root,
-		0, 0, width, height, 0,
-		CopyFromParent, InputOutput,
-		CopyFromParent, CWEventMask,
-		&swa);
+// replace the four static images with a ring of private copies in memory
+// from the selected allocator, optionally large enough to fall out of the
+// last-level cache between two uses
+void setup_source_pool(void)
+{
+	size_t frame_size = frame_bytes;
+	GLubyte *pool;
+	int k, y;
 
-	XSetWindowAttributes xattr;
-	Atom atom;
-	int one = 1;
+	if (source_pool_bytes == (size_t)-1)
+		source_pool_bytes = 2 * llc_size;
+	if (source_alloc == ALLOC_STATIC)
+		source_alloc = ALLOC_MALLOC;
 
-	xattr.override_redirect = False;
-	XChangeWindowAttributes(x_display, win, CWOverrideRedirect, &xattr);
+	num_textures = (source_pool_bytes + frame_size - 1) / frame_size;
+	if (num_textures < 4)
+		num_textures = 4;
 
-	XWMHints hints;
-	hints.input = True;
-	hints.flags = InputHint;
-	XSetWMHints(x_display, win, &hints);
+	textures = malloc(num_textures * sizeof(*textures));
+	if (textures == NULL) {
+		fprintf(stderr, "unable to allocate source pool\n");
+		exit(1);
+	}
 
-	// make the window visible on the screen
-	XMapWindow(x_display, win);
-	XStoreName(x_display, win, basename(argv[0])); // give the window a name
+	// one contiguous block, so the page size policy covers every frame
+	pool = alloc_source(num_textures * frame_size);
+	for (k = 0; k < num_textures; k++) {
+		textures[k] = pool + k * frame_size;
+		for (y = 0; y < height; y++)
+			memcpy(textures[k] + y * src_stride, images[k % 4] + y * width * 4,
+			       width * 4);
+	}
 
-	egl_display = eglGetDisplay((EGLNativeDisplayType) x_display);
-	if (egl_display == EGL_NO_DISPLAY) {
-		fprintf(stderr, "Got no EGL display.\n");
-		return 1;
+	printf("source pool: %d frames, %.1f MiB (last-level cache %.1f MiB)\n",
+	       num_textures, num_textures * frame_size / (1024. * 1024.),
+	       llc_size / (1024. * 1024.));
+	if (num_textures * frame_size <= llc_size)
+		printf("warning: source pool fits in the last-level cache\n");
+
+	printf("source alloc: %s at %p", source_alloc_names[source_alloc], pool);
+	if (numa_node >= 0)
+		printf(", numa node %d", numa_node);
+	if (source_alloc == ALLOC_THP)
+		printf(", %.1f MiB in huge pages",
+		       thp_backed_bytes(pool) / (1024. * 1024.));
+	printf("\n");
+}
+
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// map a raw clip and stream its frames instead of the static images
+void setup_source_file(void)
+{
+	struct stat st;
+	int flags = MAP_PRIVATE;
+	int fd, k;
+
+	fd = open(source_file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(source_file);
+		exit(1);
 	}
 
-	if (!eglInitialize(egl_display, NULL, NULL)) {
-		fprintf(stderr, "Unable to initialize EGL\n");
-		return 1;
+	num_textures = st.st_size / frame_bytes;
+	if (num_textures == 0) {
+		fprintf(stderr, "%s holds less than one %dx%d frame\n",
+			source_file, width, height);
+		exit(1);
 	}
 
-	EGLint attr[] = {       // some attributes to set up our egl-interface
-		EGL_BUFFER_SIZE, 32,
-		EGL_RENDERABLE_TYPE,
-		EGL_OPENGL_ES2_BIT,
-		EGL_NONE
-	};
+	if (source_populate)
+		flags |= MAP_POPULATE;
 
-	EGLConfig ecfg;
-	EGLint num_config;
-	if (!eglChooseConfig(egl_display, attr, &ecfg, 1, &num_config)) {
-		fprintf(stderr, "Failed to choose config (eglError: %d)\n",
-			eglGetError());
-		return 1;
+	source_map_size = num_textures * frame_bytes;
+	source_map = mmap(NULL, source_map_size, PROT_READ, flags, fd, 0);
+	if (source_map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
 	}
+	close(fd);
 
-	if (num_config != 1) {
-		fprintf(stderr, "Didn't get exactly one config, but %d\n",
-			num_config);
+	if (source_readahead && madvise(source_map, source_map_size, MADV_SEQUENTIAL) != 0)
+		perror("madvise(MADV_SEQUENTIAL)");
+
+	textures = malloc(num_textures * sizeof(*textures));
+	if (textures == NULL) {
+		fprintf(stderr, "unable to allocate frame table\n");
+		exit(1);
+	}
+	for (k = 0; k < num_textures; k++)
+		textures[k] = source_map + k * frame_bytes;
+
+	printf("source file: %s, %d %s frames, %s%s\n", source_file, num_textures,
+	       source_format == FORMAT_NV12 ? "nv12" : "rgba",
+	       source_populate ? "prefaulted" : "faulted on demand",
+	       source_readahead ? ", sequential readahead" : "");
+}
+
+// fault in every page of a mapped frame ahead of the upload, so that the
+// page fault cost can be reported separately from the copy into the driver
+void fault_frame(const GLubyte *data)
+{
+	const volatile GLubyte *p = data;
+	long page = sysconf(_SC_PAGESIZE);
+	struct rusage r1, r2;
+	double t1, t2;
+	size_t off;
+
+	getrusage(RUSAGE_SELF, &r1);
+	t1 = now();
+	for (off = 0; off < frame_bytes; off += page)
+		(void)p[off];
+	(void)p[frame_bytes - 1];
+	t2 = now();
+	getrusage(RUSAGE_SELF, &r2);
+
+	fault_dt += t2 - t1;
+	minor_faults += r2.ru_minflt - r1.ru_minflt;
+	major_faults += r2.ru_majflt - r1.ru_majflt;
+}
+
+static inline int align_up(int value, int align)
+{
+	return (value + align - 1) / align * align;
+}
+
+// staging copy throughput of every kernel into a mapped pixel buffer and
+// into plain memory, the fastest into what the upload path stages into
+// gets used
+void pick_copy_kernel(void)
+{
+	bool into_mapping = upload_strategy == &cpl_upload_pbo;
+	double best = 0.;
+	int k;
+
+	printf("copy kernels, %zu byte frames (MiB/s, mapped buffer / memory):\n", frame_bytes);
+	for (k = 0; cpl_copy_kernels[k].name; k++) {
+		const struct cpl_copy_kernel *kernel = &cpl_copy_kernels[k];
+		double mapped = 0., memory, rate;
+
+		if (!kernel->supported()) {
+			printf("  %-16s not supported by this CPU\n", kernel->name);
+			continue;
+		}
+		if (gles_version >= 3)
+			mapped = cpl_copy_rate(kernel, textures[0], frame_bytes, true,
+					       COPY_KERNEL_TIME);
+		memory = cpl_copy_rate(kernel, textures[0], frame_bytes, false, COPY_KERNEL_TIME);
+		printf("  %-16s %10.1f / %10.1f\n", kernel->name, mapped, memory);
+
+		rate = into_mapping ? mapped : memory;
+		if (rate > best) {
+			best = rate;
+			copy_kernel = kernel;
+		}
+	}
+	if (copy_kernel == NULL)
+		copy_kernel = &cpl_copy_kernels[0];
+	printf("staging copies with %s\n", copy_kernel->name);
+}
+
+// pick how rows of src_stride bytes get to the driver, given the unpack
+// alignment the user asked for
+void setup_unpack(void)
+{
+	struct cpl_profile profile;
+
+	// a profile from --autotune fills in what the command line left open,
+	// if it was made for these frames and the same upload path
+	if (upload_profile && cpl_read_profile(upload_profile, &profile) == 0) {
+		if (profile.width != width || profile.height != height ||
+		    profile.stride != src_stride)
+			printf("warning: %s was tuned for %dx%d frames with %d byte rows, ignoring it\n",
+			       upload_profile, profile.width, profile.height, profile.stride);
+		else if (upload_strategy && upload_strategy != profile.strategy)
+			printf("warning: %s was tuned for %s, not --upload-path %s, ignoring it\n",
+			       upload_profile, profile.strategy->name, upload_strategy->name);
+		else {
+			bool partial = (unpack_alignment_given && unpack_alignment != profile.alignment) ||
+				       (pbo_depth && pbo_depth != profile.pbo_depth) ||
+				       ((copy_kernel || copy_kernel_all) && copy_kernel != profile.copy);
+
+			upload_strategy = profile.strategy;
+			if (!unpack_alignment_given)
+				unpack_alignment = profile.alignment;
+			if (!pbo_depth)
+				pbo_depth = profile.pbo_depth;
+			if (copy_kernel == NULL && !copy_kernel_all)
+				copy_kernel = profile.copy;
+			printf("upload profile: %s, alignment %d%s%s (%f MiB/s when tuned)\n",
+			       profile.strategy->name, profile.alignment,
+			       profile.copy ? ", " : "", profile.copy ? profile.copy->name : "",
+			       profile.rate);
+			if (partial)
+				printf("upload profile only partially applied, the command line wins\n");
+		}
+	}
+
+	if (upload_strategy == NULL) {
+		if (src_stride == align_up(width * 4, unpack_alignment))
+			upload_strategy = &cpl_upload_teximage;
+		else if (gles_version >= 3 && src_stride % unpack_alignment == 0)
+			upload_strategy = &cpl_upload_row_length;
+		else
+			upload_strategy = &cpl_upload_repack;
+	}
+
+	if (src_stride != width * 4 || unpack_alignment != 1 ||
+	    upload_strategy != &cpl_upload_teximage)
+		printf("unpack: stride %d bytes, alignment %d, %s\n", src_stride,
+		       unpack_alignment, upload_strategy->name);
+
+	if (copy_kernel_all)
+		pick_copy_kernel();
+}
+
+void upload_frame(struct surface *surf, const GLubyte *data)
+{
+	if (source_format == FORMAT_NV12) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0,
+			     GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, surf->uv_texture_id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, width / 2, height / 2, 0,
+			     GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, data + width * height);
+		glActiveTexture(GL_TEXTURE0);
+	} else
+		cpl_upload_frame(&surf->up, data);
+}
+
+// parses a cpu list such as "0,2-3" into cpus[], returns the count
+int parse_cpu_list(const char *arg, int *cpus, int max)
+{
+	int n = 0;
+
+	while (*arg) {
+		char *end;
+		long first = strtol(arg, &end, 10), last = first, cpu;
+
+		if (end == arg || first < 0)
+			return 0;
+		if (*end == '-') {
+			arg = end + 1;
+			last = strtol(arg, &end, 10);
+			if (end == arg || last < first)
+				return 0;
+		}
+		// cpu_set_t has no room beyond that
+		if (last >= CPU_SETSIZE)
+			return 0;
+		for (cpu = first; cpu <= last && n < max; cpu++)
+			cpus[n++] = cpu;
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return 0;
+		arg = end;
+	}
+
+	return n;
+}
+
+void pin_thread(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+	int err;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	err = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (err != 0) {
+		fprintf(stderr, "unable to pin thread to cpu %d: %s\n", cpu, strerror(err));
+		exit(1);
+	}
+}
+
+// the same for a thread about to be created, so it never runs elsewhere
+void pin_attr(pthread_attr_t *attr, int cpu)
+{
+	cpu_set_t set;
+	int err;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	err = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+	if (err != 0) {
+		fprintf(stderr, "unable to pin thread to cpu %d: %s\n", cpu, strerror(err));
+		exit(1);
+	}
+}
+
+// request SCHED_FIFO for a thread, failing softly when not privileged
+void set_fifo(pthread_t thread, const char *what)
+{
+	struct sched_param param = { .sched_priority = sched_fifo_prio };
+	int err;
+
+	err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+	if (err != 0)
+		fprintf(stderr, "warning: unable to run %s with SCHED_FIFO: %s\n",
+			what, strerror(err));
+}
+
+static inline void cpu_relax(void)
+{
+	// spinning would starve an equal priority FIFO thread on the same cpu
+	if (sched_fifo_prio) {
+		sched_yield();
+		return;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ volatile("yield");
+#endif
+}
+
+// read governor and current frequency of the cpus we run on: the pinned
+// ones if any, otherwise every cpu that has a cpufreq policy
+int cpufreq_snapshot(struct cpufreq_state *st)
+{
+	int cpus[MAX_CPUS];
+	int ncpus = 0, n = 0, k;
+
+	if (render_cpu >= 0 || num_helper_cpus) {
+		if (render_cpu >= 0)
+			cpus[ncpus++] = render_cpu;
+		for (k = 0; k < num_helper_cpus && ncpus < MAX_CPUS; k++)
+			cpus[ncpus++] = helper_cpus[k];
+	} else {
+		ncpus = sysconf(_SC_NPROCESSORS_CONF);
+		if (ncpus > MAX_CPUS)
+			ncpus = MAX_CPUS;
+		for (k = 0; k < ncpus; k++)
+			cpus[k] = k;
+	}
+
+	for (k = 0; k < ncpus; k++) {
+		char path[128], buf[32];
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpus[k]);
+		if (!read_sysfs(path, buf, sizeof(buf)))
+			continue;
+		st[n].cpu = cpus[k];
+		st[n].khz = atol(buf);
+		st[n].warned = false;
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpus[k]);
+		if (!read_sysfs(path, st[n].governor, sizeof(st[n].governor)))
+			strcpy(st[n].governor, "?");
+		n++;
+	}
+
+	return n;
+}
+
+void print_cpufreq(const char *when, struct cpufreq_state *st, int n)
+{
+	int k;
+
+	if (n == 0) {
+		printf("cpufreq %s: not available\n", when);
+		return;
+	}
+	printf("cpufreq %s:", when);
+	for (k = 0; k < n; k++)
+		printf(" cpu%d %s %ld MHz%s", st[k].cpu, st[k].governor,
+		       st[k].khz / 1000, k + 1 < n ? "," : "");
+	printf("\n");
+}
+
+// compare against the start of the run; deviations below 5% are within
+// the granularity most cpufreq drivers report with
+void check_cpufreq(void)
+{
+	struct cpufreq_state now_st[MAX_CPUS];
+	int n = cpufreq_snapshot(now_st), k, j;
+
+	// cpus can drop out of the snapshot, so match them by number, and
+	// warn about each one only once
+	for (k = 0; k < n; k++) {
+		struct cpufreq_state *start = NULL;
+		long delta;
+
+		for (j = 0; j < num_freq && !start; j++)
+			if (freq_start[j].cpu == now_st[k].cpu)
+				start = &freq_start[j];
+		if (start == NULL || start->warned)
+			continue;
+
+		delta = labs(now_st[k].khz - start->khz);
+		if (strcmp(now_st[k].governor, start->governor) != 0 ||
+		    delta * 20 > start->khz) {
+			printf("warning: cpu%d changed from %s %ld MHz to %s %ld MHz during measurement\n",
+			       now_st[k].cpu, start->governor, start->khz / 1000,
+			       now_st[k].governor, now_st[k].khz / 1000);
+			start->warned = true;
+			freq_changed = true;
+		}
+	}
+}
+
+// synthesize a fresh frame the way a decoder or camera ISP would: every
+// pixel is written, and the content changes from frame to frame
+void produce_frame(GLubyte *data, unsigned int frame)
+{
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		uint32_t *px = (uint32_t *)(data + y * src_stride);
+		uint32_t row = 0xff000000 | ((frame & 0xff) << 16) |
+			(((y + frame) & 0xff) << 8);
+		for (x = 0; x < width; x++)
+			*px++ = row | ((x + frame) & 0xff);
+	}
+}
+
+void *producer_main(void *arg)
+{
+	struct producer *p = arg;
+	unsigned int head = 0;
+
+	while (!atomic_load_explicit(&producers_quit, memory_order_relaxed)) {
+		// wait for the render thread to release a slot
+		if (head - atomic_load_explicit(&p->tail, memory_order_acquire) >= p->depth) {
+			cpu_relax();
+			continue;
+		}
+
+		produce_frame(p->slots[head % p->depth], head * num_producers + p->index);
+		atomic_fetch_add_explicit(&p->bytes, frame_bytes, memory_order_relaxed);
+		atomic_store_explicit(&p->head, ++head, memory_order_release);
+	}
+
+	return NULL;
+}
+
+void start_producers(void)
+{
+	unsigned int k;
+	int n, err;
+
+	producers = calloc(num_producers, sizeof(*producers));
+	if (producers == NULL) {
+		fprintf(stderr, "unable to allocate producers\n");
+		exit(1);
+	}
+
+	for (n = 0; n < num_producers; n++) {
+		struct producer *p = &producers[n];
+		GLubyte *pool = alloc_source(producer_depth * frame_bytes);
+		pthread_attr_t attr;
+
+		p->index = n;
+		p->depth = producer_depth;
+		p->slots = malloc(p->depth * sizeof(*p->slots));
+		if (p->slots == NULL) {
+			fprintf(stderr, "unable to allocate producer ring\n");
+			exit(1);
+		}
+		for (k = 0; k < p->depth; k++)
+			p->slots[k] = pool + k * frame_bytes;
+		atomic_init(&p->head, 0);
+		atomic_init(&p->tail, 0);
+		atomic_init(&p->bytes, 0);
+
+		pthread_attr_init(&attr);
+		if (num_helper_cpus)
+			pin_attr(&attr, helper_cpus[n % num_helper_cpus]);
+		err = pthread_create(&p->thread, &attr, producer_main, p);
+		if (err != 0) {
+			fprintf(stderr, "unable to start producer thread: %s\n", strerror(err));
+			exit(1);
+		}
+		pthread_attr_destroy(&attr);
+		if (sched_fifo_prio)
+			set_fifo(p->thread, "producer thread");
+	}
+
+	printf("producers: %d threads, %u deep rings", num_producers, producer_depth);
+	if (num_helper_cpus) {
+		printf(", cpus");
+		for (n = 0; n < num_producers; n++)
+			printf(" %d", helper_cpus[n % num_helper_cpus]);
+	}
+	printf("\n");
+}
+
+void stop_producers(void)
+{
+	int n;
+
+	atomic_store(&producers_quit, true);
+	for (n = 0; n < num_producers; n++)
+		pthread_join(producers[n].thread, NULL);
+}
+
+// take the oldest published frame of a producer, waiting if it is behind
+const GLubyte *acquire_frame(struct producer *p)
+{
+	unsigned int tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+
+	if (atomic_load_explicit(&p->head, memory_order_acquire) == tail) {
+		double t1 = now();
+
+		stalls++;
+		while (atomic_load_explicit(&p->head, memory_order_acquire) == tail)
+			cpu_relax();
+		stall_dt += now() - t1;
+	}
+
+	return p->slots[tail % p->depth];
+}
+
+void release_frame(struct producer *p)
+{
+	atomic_fetch_add_explicit(&p->tail, 1, memory_order_release);
+}
+
+// pick the frame to upload next, from a producer or from the source ring
+// *index walks the source textures, each surface keeps its own
+const GLubyte *next_source(int *index, struct producer **producer)
+{
+	static unsigned int frame = 0;
+	const GLubyte *data;
+
+	*producer = NULL;
+	if (num_producers) {
+		*producer = &producers[frame++ % num_producers];
+		data = acquire_frame(*producer);
+	} else {
+		// drop the page tables at the end of the clip so that the next
+		// pass faults again, as freshly decoded buffers would
+		if (*index == 0 && source_map && !source_populate)
+			madvise(source_map, source_map_size, MADV_DONTNEED);
+
+		data = textures[*index];
+		*index = (*index + 1) % num_textures;
+	}
+
+	if (cache_flush)
+		flush_source(data, frame_bytes);
+	if (source_map)
+		fault_frame(data);
+
+	return data;
+}
+
+typedef uint8_t u8x8 __attribute__((vector_size(8)));
+typedef uint16_t u16x8 __attribute__((vector_size(16)));
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint8_t u8x16 __attribute__((vector_size(16)));
+
+// RGBA <-> BGRA, sixteen bytes per shuffle; dst may equal src
+void copy_swap_rb(GLubyte *dst, const GLubyte *src, size_t len)
+{
+	const u8x16 mask = { 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15 };
+	size_t k = 0;
+
+	for (; k + 16 <= len; k += 16) {
+		u8x16 v;
+		memcpy(&v, src + k, sizeof(v));
+		v = __builtin_shuffle(v, mask);
+		memcpy(dst + k, &v, sizeof(v));
+	}
+	for (; k + 4 <= len; k += 4) {
+		GLubyte r = src[k], b = src[k + 2];
+		dst[k] = b;
+		dst[k + 1] = src[k + 1];
+		dst[k + 2] = r;
+		dst[k + 3] = src[k + 3];
+	}
+}
+
+// derive the texel mapping from the texture coordinates of the current
+// vertex array, so every rotation the GL path supports comes for free
+void setup_blit_mapping(void)
+{
+	const GLfloat *bl = tex, *tl = tex + 5, *tr = tex + 10;
+	float dsdx, dtdx, dsdy, dtdy, s0, t0;
+
+	// texels per output pixel: the normalized deltas span the output's
+	// width or height, s counts source columns and t source rows, which
+	// differ once 90 or 270 degrees swap the axes of a non-square frame
+	dsdx = tr[0] - tl[0];
+	dtdx = (tr[1] - tl[1]) * height / width;
+	dsdy = (bl[0] - tl[0]) * width / height;
+	dtdy = bl[1] - tl[1];
+	blit_dsdx = lrintf(dsdx * 65536.);
+	blit_dtdx = lrintf(dtdx * 65536.);
+	blit_dsdy = lrintf(dsdy * 65536.);
+	blit_dtdy = lrintf(dtdy * 65536.);
+
+	// sample at the centre of the first output pixel
+	s0 = tl[0] * width + 0.5 * dsdx + 0.5 * dsdy;
+	t0 = tl[1] * height + 0.5 * dtdx + 0.5 * dtdy;
+	blit_s0 = lrintf(s0 * 65536.);
+	blit_t0 = lrintf(t0 * 65536.);
+}
+
+static inline int clamp(int v, int max)
+{
+	return v < 0 ? 0 : v > max ? max : v;
+}
+
+static inline u16x8 texel_pair(const uint32_t *row, int xa, int xb)
+{
+	uint32_t pair[2] = { row[xa], row[xb] };
+	u8x8 bytes;
+
+	memcpy(&bytes, pair, sizeof(bytes));
+	return __builtin_convertvector(bytes, u16x8);
+}
+
+// both neighbour columns are blended in one vector, 8 bit weights keep
+// every intermediate within 16 bits
+static inline uint32_t sample_linear(const uint32_t *texels, int32_t s, int32_t t)
+{
+	int32_t ss = s - (1 << 15), tt = t - (1 << 15);
+	int xa = ss >> 16, ya = tt >> 16;
+	uint16_t fx = (ss >> 8) & 0xff, fy = (tt >> 8) & 0xff;
+	int xb = clamp(xa + 1, width - 1), yb = clamp(ya + 1, height - 1);
+	u16x8 top, bottom, v, swapped, h;
+	u8x8 out;
+	uint32_t px;
+
+	xa = clamp(xa, width - 1);
+	ya = clamp(ya, height - 1);
+	top = texel_pair(texels + ya * (src_stride / 4), xa, xb);
+	bottom = texel_pair(texels + yb * (src_stride / 4), xa, xb);
+	v = (top * (uint16_t)(256 - fy) + bottom * fy) >> 8;
+	swapped = __builtin_shuffle(v, (u16x8){ 4, 5, 6, 7, 0, 1, 2, 3 });
+	h = (v * (uint16_t)(256 - fx) + swapped * fx) >> 8;
+	out = __builtin_convertvector(h, u8x8);
+	memcpy(&px, &out, sizeof(px));
+
+	return px;
+}
+
+// out[k] = src[-k], four texels per shuffle
+static inline void copy_reversed(uint32_t *out, const uint32_t *src, int n)
+{
+	int k = 0;
+
+	for (; k + 4 <= n; k += 4) {
+		u32x4 v;
+		memcpy(&v, src - k - 3, sizeof(v));
+		v = __builtin_shuffle(v, (u32x4){ 3, 2, 1, 0 });
+		memcpy(out + k, &v, sizeof(v));
+	}
+	for (; k < n; k++)
+		out[k] = src[-k];
+}
+
+void blit_tile(int x0, int y0, int x1, int y1)
+{
+	const uint32_t *texels = (const uint32_t *)blit_src;
+	int pitch = src_stride / 4;
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		uint32_t *out = (uint32_t *)(blit_dst + y * blit_stride);
+		int32_t s = blit_s0 + y * blit_dsdy + x0 * blit_dsdx;
+		int32_t t = blit_t0 + y * blit_dtdy + x0 * blit_dtdx;
+
+		if (filter == GL_LINEAR) {
+			for (x = x0; x < x1; x++) {
+				out[x] = sample_linear(texels, s, t);
+				s += blit_dsdx;
+				t += blit_dtdx;
+			}
+		} else if (blit_dtdx == 0 && blit_dsdx == 1 << 16) {
+			// unrotated rows are plain copies
+			memcpy(out + x0, texels + (t >> 16) * pitch + (s >> 16),
+			       (x1 - x0) * 4);
+		} else if (blit_dtdx == 0 && blit_dsdx == -(1 << 16)) {
+			copy_reversed(out + x0, texels + (t >> 16) * pitch + (s >> 16),
+				      x1 - x0);
+		} else {
+			for (x = x0; x < x1; x++) {
+				out[x] = texels[clamp(t >> 16, height - 1) * pitch +
+						clamp(s >> 16, width - 1)];
+				s += blit_dsdx;
+				t += blit_dtdx;
+			}
+		}
+
+		// convert while the row is still in L1
+		if (blit_swap_rb)
+			copy_swap_rb((GLubyte *)(out + x0), (GLubyte *)(out + x0),
+				     (x1 - x0) * 4);
+	}
+}
+
+// tiles keep the column walks of the 90/270 rotations within cache
+void blit_run_tiles(void)
+{
+	int tiles_x = (width + BLIT_TILE - 1) / BLIT_TILE;
+	int tiles = tiles_x * ((height + BLIT_TILE - 1) / BLIT_TILE);
+	int tile;
+
+	while ((tile = atomic_fetch_add(&blit_next_tile, 1)) < tiles) {
+		int x0 = (tile % tiles_x) * BLIT_TILE;
+		int y0 = (tile / tiles_x) * BLIT_TILE;
+		int x1 = x0 + BLIT_TILE < width ? x0 + BLIT_TILE : width;
+		int y1 = y0 + BLIT_TILE < height ? y0 + BLIT_TILE : height;
+
+		blit_tile(x0, y0, x1, y1);
+	}
+}
+
+void *blit_worker(void *arg)
+{
+	(void)arg;
+
+	while (1) {
+		pthread_barrier_wait(&blit_start);
+		if (blit_quit)
+			break;
+		blit_run_tiles();
+		pthread_barrier_wait(&blit_done);
+	}
+
+	return NULL;
+}
+
+void start_blitter(GLubyte *dst, int stride)
+{
+	pthread_attr_t attr;
+	int n, err;
+
+	blit_dst = dst;
+	blit_stride = stride;
+	blit_quit = false;
+	setup_blit_mapping();
+
+	if (blit_threads < 2)
+		return;
+
+	pthread_barrier_init(&blit_start, NULL, blit_threads);
+	pthread_barrier_init(&blit_done, NULL, blit_threads);
+	blit_workers = calloc(blit_threads - 1, sizeof(*blit_workers));
+	if (blit_workers == NULL) {
+		fprintf(stderr, "unable to allocate blitter threads\n");
+		exit(1);
+	}
+	for (n = 0; n < blit_threads - 1; n++) {
+		pthread_attr_init(&attr);
+		if (num_helper_cpus)
+			pin_attr(&attr, helper_cpus[n % num_helper_cpus]);
+		err = pthread_create(&blit_workers[n], &attr, blit_worker, NULL);
+		if (err != 0) {
+			fprintf(stderr, "unable to start blitter thread: %s\n", strerror(err));
+			exit(1);
+		}
+		pthread_attr_destroy(&attr);
+		if (sched_fifo_prio)
+			set_fifo(blit_workers[n], "blitter thread");
+	}
+}
+
+void stop_blitter(void)
+{
+	int n;
+
+	if (blit_threads < 2)
+		return;
+
+	blit_quit = true;
+	pthread_barrier_wait(&blit_start);
+	for (n = 0; n < blit_threads - 1; n++)
+		pthread_join(blit_workers[n], NULL);
+}
+
+// draw the quad from src into the blitter target, the calling thread
+// takes its share of the tiles
+void blit_frame(const GLubyte *src)
+{
+	blit_src = src;
+	atomic_store(&blit_next_tile, 0);
+
+	if (blit_threads > 1)
+		pthread_barrier_wait(&blit_start);
+	blit_run_tiles();
+	if (blit_threads > 1)
+		pthread_barrier_wait(&blit_done);
+}
+
+void add_energy_sensor(const char *path, const char *name, bool power, double range)
+{
+	struct energy_sensor *e = &energy_sensors[num_energy_sensors];
+	char buf[32];
+
+	if (num_energy_sensors == MAX_ENERGY_SENSORS || !read_sysfs(path, buf, sizeof(buf)))
+		return;
+	snprintf(e->path, sizeof(e->path), "%s", path);
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->power = power;
+	e->range = range;
+	e->last = atof(buf);
+	num_energy_sensors++;
+}
+
+// top level RAPL zones (package, psys) only, their subzones are included
+void scan_powercap(void)
+{
+	DIR *dir = opendir("/sys/class/powercap");
+	struct dirent *d;
+
+	if (dir == NULL)
+		return;
+	while ((d = readdir(dir)) != NULL) {
+		char path[300], name[64], range[32];
+		const char *colon = strchr(d->d_name, ':');
+
+		if (colon == NULL || strchr(colon + 1, ':'))
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/powercap/%s/name", d->d_name);
+		if (!read_sysfs(path, name, sizeof(name)))
+			snprintf(name, sizeof(name), "%s", d->d_name);
+		snprintf(path, sizeof(path), "/sys/class/powercap/%s/max_energy_range_uj", d->d_name);
+		if (!read_sysfs(path, range, sizeof(range)))
+			strcpy(range, "0");
+		snprintf(path, sizeof(path), "/sys/class/powercap/%s/energy_uj", d->d_name);
+		add_energy_sensor(path, name, false, atof(range));
+	}
+	closedir(dir);
+}
+
+// hwmon energy counters, or power readings from chips that have none
+void scan_hwmon(void)
+{
+	DIR *dir = opendir("/sys/class/hwmon");
+	struct dirent *d;
+
+	if (dir == NULL)
+		return;
+	while ((d = readdir(dir)) != NULL) {
+		char path[300], chip[32], name[64];
+		int k, before = num_energy_sensors;
+
+		if (strncmp(d->d_name, "hwmon", 5) != 0)
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/hwmon/%s/name", d->d_name);
+		if (!read_sysfs(path, chip, sizeof(chip)))
+			snprintf(chip, sizeof(chip), "%s", d->d_name);
+
+		for (k = 0; k < 8; k++) {
+			snprintf(path, sizeof(path), "/sys/class/hwmon/%s/energy%d_input", d->d_name, k);
+			snprintf(name, sizeof(name), "%s energy%d", chip, k);
+			add_energy_sensor(path, name, false, 0.);
+		}
+		if (num_energy_sensors > before)
+			continue;
+		for (k = 0; k < 8; k++) {
+			snprintf(path, sizeof(path), "/sys/class/hwmon/%s/power%d_input", d->d_name, k);
+			snprintf(name, sizeof(name), "%s power%d", chip, k);
+			add_energy_sensor(path, name, true, 0.);
+		}
+	}
+	closedir(dir);
+}
+
+// powercap if it is readable (it often needs root), hwmon otherwise
+void setup_energy(void)
+{
+	int k;
+
+	scan_powercap();
+	if (num_energy_sensors == 0)
+		scan_hwmon();
+	energy_last_t = now();
+
+	if (num_energy_sensors == 0) {
+		printf("energy: no readable powercap or hwmon sensor, not reporting it\n");
+		return;
+	}
+	printf("energy sensors:");
+	for (k = 0; k < num_energy_sensors; k++)
+		printf(" %s%s", energy_sensors[k].name, energy_sensors[k].power ? " (power)" : "");
+	printf("\n");
+}
+
+// joules used since the last call, summed over all sensors
+double read_energy(void)
+{
+	double t = now(), joules = 0.;
+	int k;
+
+	for (k = 0; k < num_energy_sensors; k++) {
+		struct energy_sensor *e = &energy_sensors[k];
+		char buf[32];
+		double value;
+
+		if (!read_sysfs(e->path, buf, sizeof(buf)))
+			continue;
+		value = atof(buf);
+		if (e->power)
+			joules += (value + e->last) * 0.5e-6 * (t - energy_last_t);
+		else if (value >= e->last)
+			joules += (value - e->last) * 1e-6;
+		else if (e->range > 0.)
+			joules += (value + e->range - e->last) * 1e-6;
+		e->last = value;
+	}
+	energy_last_t = t;
+
+	return joules;
+}
+
+void report_energy(unsigned long long frames, double dt, double upload_bytes, double fill_bytes)
+{
+	double joules;
+
+	if (!num_energy_sensors)
+		return;
+	joules = read_energy();
+	if (joules <= 0. || frames == 0)
+		return;
+
+	printf("energy: %f J (%f W), %f mJ/frame", joules, joules / dt, joules * 1e3 / frames);
+	if (upload_bytes > 0.)
+		printf(", upload %f MiB/J", upload_bytes / (joules * 1024. * 1024.));
+	if (fill_bytes > 0.)
+		printf(", fill %f MiB/J", fill_bytes / (joules * 1024. * 1024.));
+	printf("\n");
+}
+
+// copies with non-temporal stores, so the destination does not displace
+// the source from the cache, like a write-combined GPU mapping
+const struct cpl_copy_kernel *nt_kernel(void)
+{
+	const struct cpl_copy_kernel *k;
+
+	if ((k = cpl_find_copy_kernel("sse2-nt")) || (k = cpl_find_copy_kernel("neon-nt")))
+		return k;
+	return &cpl_copy_kernels[0];
+}
+
+// sums the buffer so the loads cannot be dropped, through memcpy as the
+// embedded images are only byte aligned, it still compiles to plain loads
+uint64_t read_buffer(const void *src, size_t len)
+{
+	const unsigned char *p = src;
+	uint64_t a = 0, b = 0, c = 0, d = 0, w[4];
+	size_t k, n = len / 8;
+
+	for (k = 0; k + 4 <= n; k += 4) {
+		memcpy(w, p + k * 8, sizeof(w));
+		a += w[0];
+		b += w[1];
+		c += w[2];
+		d += w[3];
+	}
+	for (; k < n; k++) {
+		memcpy(w, p + k * 8, sizeof(w[0]));
+		a += w[0];
+	}
+
+	return a + b + c + d;
+}
+
+struct bw_thread {
+	pthread_t thread;
+	enum bw_kernel kernel;
+	const struct cpl_copy_kernel *nt;
+	GLubyte *src[4];
+	GLubyte *dst;
+	double bytes;
+	double dt;
+	uint64_t sink;
+};
+
+pthread_barrier_t bw_start;
+
+// one kernel over the frame sized buffers for CALIBRATE_TIME
+void bw_run(struct bw_thread *b)
+{
+	double t1 = now(), t;
+	unsigned int frame = 0;
+
+	b->bytes = 0.;
+	do {
+		const GLubyte *src = b->src[frame++ % 4];
+
+		switch (b->kernel) {
+		case BW_MEMCPY:
+			memcpy(b->dst, src, frame_bytes);
+			break;
+		case BW_NT_COPY:
+			b->nt->copy(b->dst, src, frame_bytes);
+			break;
+		case BW_READ:
+			b->sink += read_buffer(src, frame_bytes);
+			break;
+		case BW_WRITE:
+			memset(b->dst, frame, frame_bytes);
+			break;
+		default:
+			break;
+		}
+		b->bytes += frame_bytes;
+		t = now();
+	} while (t - t1 < CALIBRATE_TIME);
+	b->dt = t - t1;
+}
+
+void *bw_main(void *arg)
+{
+	struct bw_thread *b = arg;
+
+	pthread_barrier_wait(&bw_start);
+	bw_run(b);
+	return NULL;
+}
+
+// memory bandwidth at the size of the source frames, one thread and then
+// all of them; a copy counts the bytes copied, as an upload does
+void run_calibration(void)
+{
+	int threads = calibrate_threads ? calibrate_threads : sysconf(_SC_NPROCESSORS_ONLN);
+	struct bw_thread *bw = calloc(threads, sizeof(*bw));
+	double single[NUM_BW_KERNELS], multi[NUM_BW_KERNELS];
+	int n, k, f;
+
+	if (bw == NULL) {
+		fprintf(stderr, "unable to allocate calibration threads\n");
+		exit(1);
+	}
+
+	// the first thread reads the real source frames, the others copies
+	// of the same size, so the cache sees the same footprint per thread
+	for (n = 0; n < threads; n++) {
+		for (f = 0; f < 4; f++) {
+			if (n == 0) {
+				bw[n].src[f] = textures[f % num_textures];
+				continue;
+			}
+			if (posix_memalign((void **)&bw[n].src[f], 64, frame_bytes) != 0) {
+				fprintf(stderr, "unable to allocate calibration buffers\n");
+				exit(1);
+			}
+			memcpy(bw[n].src[f], textures[f % num_textures], frame_bytes);
+		}
+		if (posix_memalign((void **)&bw[n].dst, 64, frame_bytes) != 0) {
+			fprintf(stderr, "unable to allocate calibration buffers\n");
+			exit(1);
+		}
+		memset(bw[n].dst, 0, frame_bytes);
+		bw[n].nt = nt_kernel();
+	}
+
+	for (k = 0; k < NUM_BW_KERNELS; k++) {
+		bw[0].kernel = k;
+		bw_run(&bw[0]);
+		single[k] = bw[0].bytes / (bw[0].dt * 1024. * 1024.);
+
+		pthread_barrier_init(&bw_start, NULL, threads);
+		for (n = 1; n < threads; n++) {
+			bw[n].kernel = k;
+			if (pthread_create(&bw[n].thread, NULL, bw_main, &bw[n]) != 0) {
+				fprintf(stderr, "unable to start calibration thread\n");
+				exit(1);
+			}
+		}
+		pthread_barrier_wait(&bw_start);
+		bw_run(&bw[0]);
+		for (n = 1; n < threads; n++)
+			pthread_join(bw[n].thread, NULL);
+		pthread_barrier_destroy(&bw_start);
+
+		// all threads ran for about the same time
+		multi[k] = 0.;
+		for (n = 0; n < threads; n++)
+			multi[k] += bw[n].bytes / (bw[n].dt * 1024. * 1024.);
+	}
+
+	printf("memory bandwidth, %zu byte frames (MiB/s, 1 thread / %d threads):\n",
+	       frame_bytes, threads);
+	for (k = 0; k < NUM_BW_KERNELS; k++)
+		printf("  %-8s %10.1f / %10.1f\n", bw_kernel_names[k], single[k], multi[k]);
+
+	memcpy_ceiling = single[BW_MEMCPY];
+	memcpy_ceiling_mt = multi[BW_MEMCPY];
+
+	for (n = 1; n < threads; n++) {
+		for (f = 0; f < 4; f++)
+			free(bw[n].src[f]);
+	}
+	for (n = 0; n < threads; n++)
+		free(bw[n].dst);
+	free(bw);
+}
+
+// forks the --processes workers; returns the worker index in a worker and
+// -1 in the parent, which only waits for them
+int fork_workers(void)
+{
+	pthread_barrierattr_t attr;
+	size_t size = sizeof(*workers) + num_processes * sizeof(workers->results[0]);
+	int k;
+
+	workers = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (workers == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	memset(workers, 0, size);
+
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(&workers->barrier, &attr, num_processes);
+	pthread_barrierattr_destroy(&attr);
+
+	printf("%d worker processes%s\n", num_processes,
+	       duration ? "" : ", interrupt to stop");
+
+	// workers must not flush each other's half-written lines
+	fflush(stdout);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (k = 0; k < num_processes; k++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			worker_result = &workers->results[k];
+			worker_result->pid = getpid();
+			return k;
+		}
+		workers->results[k].pid = pid;
+	}
+
+	return -1;
+}
+
+int wait_workers(void)
+{
+	unsigned long long frames = 0;
+	double upload_bytes = 0., fps = 0., fill = 0., up = 0., wall = 0.;
+	int k, left = num_processes, failed = 0;
+
+	while (left) {
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if (pid < 0)
+			break;
+		left--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed++;
+			// the others would wait at the barrier forever
+			if (atomic_load(&workers->started) < num_processes)
+				for (k = 0; k < num_processes; k++)
+					if (workers->results[k].pid != pid)
+						kill(workers->results[k].pid, SIGKILL);
+		}
+	}
+
+	for (k = 0; k < num_processes; k++) {
+		struct worker_result *w = &workers->results[k];
+
+		if (w->elapsed <= 0.) {
+			printf("process %d (pid %d): no result\n", k, w->pid);
+			continue;
+		}
+		printf("process %d (pid %d): fps %f", k, w->pid, w->frames / w->elapsed);
+		if (fillrate)
+			printf(", fill rate %f MiB/s",
+			       (w->frames * width * height * 4) / (w->elapsed * 1024. * 1024.));
+		// time inside the upload calls, as the single process report
+		if (upload && w->upload_time > 0.) {
+			printf(", texture upload rate %f MiB/s",
+			       w->upload_bytes / (w->upload_time * 1024. * 1024.));
+			if (memcpy_ceiling > 0.)
+				printf(", %.0f%% of memcpy", 100. * w->upload_bytes /
+				       (w->upload_time * 1024. * 1024.) / memcpy_ceiling);
+			up += w->upload_bytes / (w->upload_time * 1024. * 1024.);
+		}
+		printf("\n");
+		frames += w->frames;
+		upload_bytes += w->upload_bytes;
+		fps += w->frames / w->elapsed;
+		fill += (w->frames * width * height * 4) / (w->elapsed * 1024. * 1024.);
+		wall += w->upload_bytes / (w->elapsed * 1024. * 1024.);
+	}
+
+	printf("total over %d processes: %llu frames, fps %f", num_processes, frames, fps);
+	if (fillrate)
+		printf(", fill rate %f MiB/s", fill);
+	// summed per process call rates, as the multi-threaded memcpy is summed
+	// per thread, the wall clock figure is what the processes got done
+	if (upload) {
+		printf(", texture upload rate %f MiB/s", up);
+		if (memcpy_ceiling_mt > 0.)
+			printf(", %.0f%% of multi-threaded memcpy", 100. * up / memcpy_ceiling_mt);
+		printf(", %f MiB/s wall clock (%.0f MiB)", wall, upload_bytes / (1024. * 1024.));
+	}
+	printf("\n");
+
+	return failed ? 1 : 0;
+}
+
+// common to every main loop: pin and prioritize the render thread, start
+// the producers and take the cpufreq baseline
+void begin_run(void)
+{
+	if (render_cpu >= 0)
+		pin_thread(pthread_self(), render_cpu);
+	if (sched_fifo_prio)
+		set_fifo(pthread_self(), "render thread");
+	if (num_producers)
+		start_producers();
+
+	num_freq = cpufreq_snapshot(freq_start);
+	print_cpufreq("at start", freq_start, num_freq);
+
+	// every worker is set up, start measuring together
+	if (worker_result) {
+		pthread_barrier_wait(&workers->barrier);
+		atomic_fetch_add(&workers->started, 1);
+	}
+
+	run_start = now();
+	if (duration)
+		alarm(duration);
+	if (num_energy_sensors)
+		read_energy();
+}
+
+void end_run(void)
+{
+	struct cpufreq_state freq_end[MAX_CPUS];
+
+	if (num_producers)
+		stop_producers();
+
+	if (worker_result) {
+		int k;
+
+		worker_result->elapsed = now() - run_start;
+		for (k = 0; k < num_surfaces; k++) {
+			worker_result->frames += surfaces[k].total_frames;
+			worker_result->upload_bytes += surfaces[k].total_upload;
+			worker_result->upload_time += surfaces[k].total_upload_dt;
+		}
+	}
+
+	print_cpufreq("at end", freq_end, cpufreq_snapshot(freq_end));
+	if (freq_changed)
+		printf("warning: cpu frequency changed during measurement, results are not stable\n");
+}
+
+void on_signal(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+// the --renderer cpu main loop: same quad, same source frames, drawn into
+// a plain memory buffer
+int run_cpu_renderer(void)
+{
+	struct producer *p;
+	GLubyte *dst;
+	double t1, t2;
+	int index = 0, num_frames = 0;
+
+	if (posix_memalign((void **)&dst, 64, width * height * 4) != 0) {
+		fprintf(stderr, "unable to allocate blitter target\n");
+		return 1;
+	}
+	memset(dst, 0, width * height * 4);
+
+	start_blitter(dst, width * 4);
+	printf("cpu renderer: %d threads, %s sampling, %dx%d tiles\n", blit_threads,
+	       filter == GL_LINEAR ? "bilinear" : "nearest", BLIT_TILE, BLIT_TILE);
+
+	begin_run();
+
+	t1 = now();
+	while (!interrupted) {
+		blit_frame(next_source(&index, &p));
+		if (p)
+			release_frame(p);
+		surfaces[0].total_frames++;
+
+		if (++num_frames % 1000 == 0) {
+			float dt;
+
+			t2 = now();
+			dt = t2 - t1;
+			printf("fps: %f\n", num_frames / dt);
+			printf("cpu fill rate: %f MiB/s\n", (num_frames * width * height * 4) / (dt * 1024. * 1024.));
+			report_energy(num_frames, dt, 0., num_frames * width * height * 4.);
+			check_cpufreq();
+			num_frames = 0;
+			t1 = t2;
+		}
+	}
+
+	end_run();
+	stop_blitter();
+
+	return 0;
+}
+
+bool shm_attach_failed;
+
+int shm_attach_error(Display *display, XErrorEvent *error)
+{
+	shm_attach_failed = true;
+	return 0;
+}
+
+// false if the server cannot attach the segment, as on a remote display
+bool create_shm_buffer(struct shm_buffer *b)
+{
+	int screen = DefaultScreen(x_display);
+	int (*handler)(Display *, XErrorEvent *);
+
+	b->image = XShmCreateImage(x_display, DefaultVisual(x_display, screen),
+				   DefaultDepth(x_display, screen), ZPixmap, NULL,
+				   &b->info, width, height);
+	if (b->image == NULL || b->image->bits_per_pixel != 32) {
+		fprintf(stderr, "xshm presentation needs a 32 bpp visual\n");
+		exit(1);
+	}
+
+	b->info.shmid = shmget(IPC_PRIVATE, b->image->bytes_per_line * height,
+			       IPC_CREAT | 0600);
+	if (b->info.shmid < 0) {
+		perror("shmget");
+		exit(1);
+	}
+	b->info.shmaddr = b->image->data = shmat(b->info.shmid, NULL, 0);
+	if (b->info.shmaddr == (char *)-1) {
+		perror("shmat");
+		exit(1);
+	}
+	b->info.readOnly = False;
+
+	// a refused attach only shows up as an error once the server saw it
+	shm_attach_failed = false;
+	handler = XSetErrorHandler(shm_attach_error);
+	if (!XShmAttach(x_display, &b->info))
+		shm_attach_failed = true;
+	XSync(x_display, False);
+	XSetErrorHandler(handler);
+
+	// the segment goes away once both sides have detached
+	shmctl(b->info.shmid, IPC_RMID, NULL);
+	if (shm_attach_failed) {
+		b->image->data = NULL;
+		XDestroyImage(b->image);
+		shmdt(b->info.shmaddr);
+		return false;
+	}
+	b->shm = true;
+	b->busy = false;
+	return true;
+}
+
+// a client memory image for XPutImage, which copies it into the request
+void create_put_buffer(struct shm_buffer *b)
+{
+	int screen = DefaultScreen(x_display);
+
+	b->image = XCreateImage(x_display, DefaultVisual(x_display, screen),
+				DefaultDepth(x_display, screen), ZPixmap, 0, NULL,
+				width, height, 32, 0);
+	if (b->image == NULL || b->image->bits_per_pixel != 32) {
+		fprintf(stderr, "xshm presentation needs a 32 bpp visual\n");
+		exit(1);
+	}
+	b->image->data = malloc(b->image->bytes_per_line * height);
+	if (b->image->data == NULL) {
+		fprintf(stderr, "unable to allocate the XPutImage buffer\n");
+		exit(1);
+	}
+	b->shm = false;
+	b->busy = false;
+}
+
+void destroy_shm_buffer(struct shm_buffer *b)
+{
+	if (b->shm) {
+		XShmDetach(x_display, &b->info);
+		b->image->data = NULL;
+		XDestroyImage(b->image);
+		shmdt(b->info.shmaddr);
+	} else {
+		// frees data as well
+		XDestroyImage(b->image);
+	}
+}
+
+// the --present xshm main loop: frames are copied or blitted into shared
+// memory images and handed to the server with XShmPutImage, a buffer is
+// only reused after the server reported ShmCompletion for it.  Servers
+// without MIT-SHM or that cannot reach our memory get XPutImage instead.
+int run_xshm_present(Window win)
+{
+	struct shm_buffer buffers[XSHM_BUFFERS];
+	float copy_dt = 0., wait_dt = 0.;
+	double t1, t2, ta;
+	int completion = -1, k, index = 0, num_frames = 0;
+	unsigned int frame = 0;
+	bool quit = false;
+	bool use_shm, swap_rb;
+	GC gc;
+
+	use_shm = XShmQueryExtension(x_display);
+	if (use_shm)
+		completion = XShmGetEventBase(x_display) + ShmCompletion;
+	gc = XCreateGC(x_display, win, 0, NULL);
+
+	for (k = 0; k < XSHM_BUFFERS && use_shm; k++)
+		if (!create_shm_buffer(&buffers[k])) {
+			while (k--)
+				destroy_shm_buffer(&buffers[k]);
+			use_shm = false;
+		}
+	if (!use_shm)
+		for (k = 0; k < XSHM_BUFFERS; k++)
+			create_put_buffer(&buffers[k]);
+
+	// our frames are RGBA bytes, most visuals want BGRA in memory
+	swap_rb = (buffers[0].image->red_mask == 0xff0000) ==
+		(buffers[0].image->byte_order == LSBFirst);
+
+	if (renderer == RENDERER_CPU) {
+		blit_swap_rb = swap_rb;
+		start_blitter((GLubyte *)buffers[0].image->data,
+			      buffers[0].image->bytes_per_line);
+	}
+	printf("xshm present: %d buffers, %s, %s%s\n", XSHM_BUFFERS,
+	       use_shm ? "XShmPutImage" : "XPutImage fallback",
+	       renderer == RENDERER_CPU ? "cpu renderer" : "frame copy",
+	       swap_rb ? ", red/blue swapped" : "");
+
+	begin_run();
+
+	t1 = now();
+	while (!quit && !interrupted) {
+		struct shm_buffer *b = &buffers[frame++ % XSHM_BUFFERS];
+		struct producer *p;
+		const GLubyte *data;
+
+		ta = now();
+		while (b->busy || XPending(x_display)) {
+			XEvent xev;
+			XNextEvent(x_display, &xev);
+
+			if (xev.type == KeyPress)
+				quit = true;
+			else if (xev.type == completion) {
+				XShmCompletionEvent *ce = (XShmCompletionEvent *)&xev;
+				for (k = 0; k < XSHM_BUFFERS; k++)
+					if (buffers[k].info.shmseg == ce->shmseg)
+						buffers[k].busy = false;
+			}
+		}
+		wait_dt += now() - ta;
+
+		data = next_source(&index, &p);
+
+		ta = now();
+		if (renderer == RENDERER_CPU) {
+			blit_dst = (GLubyte *)b->image->data;
+			blit_frame(data);
+		} else {
+			int y;
+			for (y = 0; y < height; y++) {
+				GLubyte *row = (GLubyte *)b->image->data + y * b->image->bytes_per_line;
+				if (swap_rb)
+					copy_swap_rb(row, data + y * src_stride, width * 4);
+				else
+					memcpy(row, data + y * src_stride, width * 4);
+			}
+		}
+		copy_dt += now() - ta;
+
+		if (p)
+			release_frame(p);
+
+		if (b->shm) {
+			XShmPutImage(x_display, win, gc, b->image, 0, 0, 0, 0, width, height, True);
+			b->busy = true;
+		} else {
+			XPutImage(x_display, win, gc, b->image, 0, 0, 0, 0, width, height);
+		}
+		XFlush(x_display);
+		surfaces[0].total_frames++;
+
+		if (++num_frames % 1000 == 0) {
+			float dt;
+
+			t2 = now();
+			dt = t2 - t1;
+			printf("fps: %f\n", num_frames / dt);
+			printf("xshm present rate: %f MiB/s\n", (num_frames * width * height * 4) / (dt * 1024. * 1024.));
+			printf("%s: %f MiB/s, present wait %f ms/frame\n",
+			       renderer == RENDERER_CPU ? "cpu fill rate" :
+			       use_shm ? "shm copy rate" : "image copy rate",
+			       (num_frames * width * height * 4) / (copy_dt * 1024. * 1024.),
+			       wait_dt * 1e3 / num_frames);
+			report_energy(num_frames, dt, 0., num_frames * width * height * 4.);
+			check_cpufreq();
+			num_frames = 0;
+			copy_dt = 0.;
+			wait_dt = 0.;
+			t1 = t2;
+		}
+	}
+
+	end_run();
+	if (renderer == RENDERER_CPU)
+		stop_blitter();
+
+	XSync(x_display, False);
+	for (k = 0; k < XSHM_BUFFERS; k++)
+		destroy_shm_buffer(&buffers[k]);
+	XFreeGC(x_display, gc);
+	XDestroyWindow(x_display, win);
+	XCloseDisplay(x_display);
+
+	return 0;
+}
+
+// bytes per pixel of a glReadPixels format/type pair, 0 if unknown
+int pixel_size(GLenum format, GLenum type)
+{
+	switch (type) {
+	case GL_UNSIGNED_SHORT_5_6_5:
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		return 2;
+	case GL_UNSIGNED_BYTE:
+		switch (format) {
+		case GL_RGBA:
+		case GL_BGRA_EXT:
+			return 4;
+		case GL_RGB:
+			return 3;
+		case GL_LUMINANCE_ALPHA:
+		case GL_RG:
+			return 2;
+		case GL_LUMINANCE:
+		case GL_ALPHA:
+		case GL_RED:
+			return 1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+void setup_readback(void)
+{
+	size_t size;
+	int k;
+
+	if (readback_native) {
+		GLint format, type;
+
+		glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &format);
+		glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &type);
+		if (pixel_size(format, type)) {
+			read_format = format;
+			read_type = type;
+		} else {
+			printf("warning: unknown native read format 0x%04x/0x%04x, using GL_RGBA\n",
+			       format, type);
+		}
+	}
+	read_bpp = pixel_size(read_format, read_type);
+	size = width * height * read_bpp;
+
+	// rows of 3 byte pixels need not be 4 byte aligned
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	readback_buf = malloc(size);
+	if (readback_buf == NULL) {
+		fprintf(stderr, "unable to allocate readback buffer\n");
+		exit(1);
+	}
+
+	if (readback == READBACK_PBO) {
+		if (gles_version < 3) {
+			fprintf(stderr, "pixel pack buffers need OpenGL ES 3\n");
+			exit(1);
+		}
+		readback_pbos = calloc(readback_depth, sizeof(*readback_pbos));
+		readback_fences = calloc(readback_depth, sizeof(*readback_fences));
+		readback_issued = calloc(readback_depth, sizeof(*readback_issued));
+		if (!readback_pbos || !readback_fences || !readback_issued) {
+			fprintf(stderr, "unable to allocate readback ring\n");
+			exit(1);
+		}
+		glGenBuffers(readback_depth, readback_pbos);
+		for (k = 0; k < readback_depth; k++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbos[k]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	printf("readback: %s", readback == READBACK_PBO ? "pbo" : "sync");
+	if (readback == READBACK_PBO)
+		printf(" x%d", readback_depth);
+	printf(", format 0x%04x type 0x%04x (%d bytes/pixel)%s\n", read_format,
+	       read_type, read_bpp, readback_native ? ", native" : "");
+}
+
+void record_latency(double dt)
+{
+	if (latency_count == 0 || dt < latency_min)
+		latency_min = dt;
+	if (latency_count == 0 || dt > latency_max)
+		latency_max = dt;
+	latency_sum += dt;
+	latency_count++;
+}
+
+// wait for the readback in a ring slot and copy it out of the pack buffer
+void collect_readback(unsigned int slot)
+{
+	size_t size = width * height * read_bpp;
+	void *ptr;
+
+	glClientWaitSync(readback_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+	glDeleteSync(readback_fences[slot]);
+	readback_fences[slot] = 0;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbos[slot]);
+	ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (ptr) {
+		memcpy(readback_buf, ptr, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	record_latency(now() - readback_issued[slot]);
+}
+
+void read_back(void)
+{
+	double t1 = now();
+
+	if (readback == READBACK_SYNC) {
+		glReadPixels(0, 0, width, height, read_format, read_type, readback_buf);
+		record_latency(now() - t1);
+	} else {
+		unsigned int slot = readback_frame++ % readback_depth;
+
+		// the slot comes around again, finish what was issued into it
+		if (readback_fences[slot])
+			collect_readback(slot);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbos[slot]);
+		glReadPixels(0, 0, width, height, read_format, read_type, 0);
+		readback_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readback_issued[slot] = now();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	readback_dt += now() - t1;
+	readback_size += width * height * read_bpp;
+}
+
+// one frame per line, rects as x,y,w,h separated by blanks
+void load_dirty_script(void)
+{
+	char line[4096];
+	int num_rects = 0, max_rects = 0, max_frames = 0;
+	FILE *f = fopen(dirty_script, "r");
+
+	if (f == NULL) {
+		perror(dirty_script);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *tok, *save;
+
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		if (num_script_frames + 1 >= max_frames) {
+			max_frames = max_frames ? 2 * max_frames : 64;
+			script_frames = realloc(script_frames, max_frames * sizeof(*script_frames));
+		}
+		script_frames[num_script_frames++] = num_rects;
+
+		for (tok = strtok_r(line, " \t\r\n", &save); tok;
+		     tok = strtok_r(NULL, " \t\r\n", &save)) {
+			struct rect r;
+
+			if (sscanf(tok, "%d,%d,%d,%d", &r.x, &r.y, &r.w, &r.h) != 4 ||
+			    r.x < 0 || r.y < 0 || r.w <= 0 || r.h <= 0 ||
+			    r.x + r.w > width || r.y + r.h > height) {
+				fprintf(stderr, "%s: invalid rect '%s' for a %dx%d frame\n",
+					dirty_script, tok, width, height);
+				exit(1);
+			}
+			if (num_rects >= max_rects) {
+				max_rects = max_rects ? 2 * max_rects : 256;
+				script_rects = realloc(script_rects, max_rects * sizeof(*script_rects));
+			}
+			script_rects[num_rects++] = r;
+		}
+	}
+	fclose(f);
+
+	if (num_script_frames == 0) {
+		fprintf(stderr, "%s: no frames\n", dirty_script);
+		exit(1);
+	}
+	script_frames[num_script_frames] = num_rects;
+	printf("dirty script: %d frames, %d rects\n", num_script_frames, num_rects);
+}
+
+void setup_dirty(void)
+{
+	if (dirty_script)
+		load_dirty_script();
+
+	if (gles_version < 3 || upload_strategy == &cpl_upload_repack)
+		dirty_repack = 1;
+	// repacked rect rows are only 4 byte aligned
+	if (dirty_repack && unpack_alignment > 4)
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (dirty_repack) {
+		repack_buf = malloc(width * height * 4);
+		if (repack_buf == NULL) {
+			fprintf(stderr, "unable to allocate repack buffer\n");
+			exit(1);
+		}
+	}
+
+	if (!dirty_script)
+		printf("dirty rects: %d per frame covering %.0f%% of the frame", dirty_rects,
+		       dirty_fraction * 100.);
+	else
+		printf("dirty rects: scripted");
+	printf(", %s\n", dirty_repack ? "cpu repack" : "GL_UNPACK_ROW_LENGTH");
+}
+
+// K rects of equal area adding up to dirty_fraction, at random positions
+int random_rects(struct rect *rects)
+{
+	static unsigned int seed = 1;
+	float side = sqrtf(dirty_fraction / dirty_rects);
+	int k;
+
+	for (k = 0; k < dirty_rects; k++) {
+		float aspect = 0.5 + rand_r(&seed) / (float)RAND_MAX;
+		struct rect *r = &rects[k];
+
+		r->w = lrintf(side * aspect * width);
+		r->h = lrintf(side / aspect * height);
+		r->w = r->w < 1 ? 1 : r->w > width ? width : r->w;
+		r->h = r->h < 1 ? 1 : r->h > height ? height : r->h;
+		r->x = rand_r(&seed) % (width - r->w + 1);
+		r->y = rand_r(&seed) % (height - r->h + 1);
+	}
+
+	return dirty_rects;
+}
+
+void upload_rect(const GLubyte *data, const struct rect *r)
+{
+	const GLubyte *src = data + r->y * src_stride + r->x * 4;
+	double t1 = now(), dt;
+	double bytes = r->w * r->h * 4.;
+	GLint row_length = 0;
+
+	if (dirty_repack && r->w * 4 != src_stride) {
+		int y;
+
+		// GLES2 has no row length, gather the rows first
+		for (y = 0; y < r->h; y++)
+			memcpy(repack_buf + y * r->w * 4, src + y * src_stride, r->w * 4);
+		src = repack_buf;
+		// on GLES3 an earlier strategy may have left the source stride set
+		if (gles_version >= 3) {
+			glGetIntegerv(GL_UNPACK_ROW_LENGTH, &row_length);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		}
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->w, r->h, GL_RGBA,
+			GL_UNSIGNED_BYTE, src);
+	if (row_length)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+
+	dt = now() - t1;
+	fit_n += 1.;
+	fit_b += bytes;
+	fit_t += dt;
+	fit_bb += bytes * bytes;
+	fit_bt += bytes * dt;
+	surfaces[0].upload_size += bytes;
+	surfaces[0].total_upload += bytes;
+}
+
+void upload_dirty(const GLubyte *data)
+{
+	static unsigned int frame = 0, script_frame = 0;
+	struct rect rects[256];
+	const struct rect *list = rects;
+	int n, k;
+
+	// a full frame now and then anchors the fit at the other end
+	if (frame++ % FULL_UPLOAD_EVERY == 0) {
+		struct rect full = { 0, 0, width, height };
+		double t1 = now();
+
+		if (!dirty_repack)
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, src_stride / 4);
+		upload_rect(data, &full);
+		full_dt += now() - t1;
+		full_count++;
+		return;
+	}
+
+	if (dirty_script) {
+		int f = script_frame++ % num_script_frames;
+		list = &script_rects[script_frames[f]];
+		n = script_frames[f + 1] - script_frames[f];
+	} else {
+		n = random_rects(rects);
+	}
+
+	if (!dirty_repack)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, src_stride / 4);
+	for (k = 0; k < n; k++)
+		upload_rect(data, &list[k]);
+}
+
+void report_dirty(void)
+{
+	double wh4 = width * height * 4.;
+	double denom = fit_n * fit_bb - fit_b * fit_b;
+	double a, c, full, calls, bytes;
+
+	if (fit_n < 2 || denom <= 0.)
+		return;
+
+	// t = a + c * bytes
+	c = (fit_n * fit_bt - fit_b * fit_t) / denom;
+	a = (fit_t - c * fit_b) / fit_n;
+	full = full_count ? full_dt / full_count : a + c * wh4;
+	calls = fit_n - full_count;
+	bytes = calls > 0 ? (fit_b - full_count * wh4) / calls : 0.;
+
+	printf("dirty rects: %f us/call, %f KiB/call, fit %f us + %f MiB/s\n",
+	       (fit_t - full_dt) * 1e6 / (calls > 0 ? calls : 1), bytes / 1024.,
+	       a * 1e6, c > 0. ? 1. / (c * 1024. * 1024.) : 0.);
+	if (bytes > 0.)
+		printf("full upload %f us, cheaper than %.1f rects of this size per frame\n",
+		       full * 1e6, full / (a + c * bytes));
+
+	fit_n = fit_b = fit_t = fit_bb = fit_bt = 0.;
+	full_dt = 0.;
+	full_count = 0;
+}
+
+bool has_extension(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = list;
+
+	while (p && (p = strstr(p, name)) != NULL) {
+		if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return true;
+		p += len;
+	}
+
+	return false;
+}
+
+void setup_damage(void)
+{
+	const char *ext = eglQueryString(egl_display, EGL_EXTENSIONS);
+
+	if (has_extension(ext, "EGL_KHR_partial_update"))
+		set_damage_region = (PFNEGLSETDAMAGEREGIONKHRPROC)
+			eglGetProcAddress("eglSetDamageRegionKHR");
+	if (has_extension(ext, "EGL_KHR_swap_buffers_with_damage"))
+		swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	else if (has_extension(ext, "EGL_EXT_swap_buffers_with_damage"))
+		swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
+	if (set_damage_region && swap_with_damage)
+		damage_method = "partial update + swap with damage";
+	else if (set_damage_region)
+		damage_method = "partial update";
+	else if (swap_with_damage)
+		damage_method = "swap with damage";
+	else
+		printf("warning: no EGL damage extension, falling back to full swaps\n");
+
+	printf("damage: %.0f%% of the surface, %s\n", damage_fraction * 100., damage_method);
+}
+
+// called before anything is drawn into the back buffer
+void begin_damage(struct surface *surf)
+{
+	static int band = 0;
+	int h = lrintf(damage_fraction * height);
+	EGLint age = 0;
+
+	if (h < 1)
+		h = 1;
+	if (band + h > height)
+		band = 0;
+
+	// EGL rects have their origin at the bottom left, like GL
+	damage_rect[0] = 0;
+	damage_rect[1] = band;
+	damage_rect[2] = width;
+	damage_rect[3] = h;
+	band += h;
+
+	if (set_damage_region) {
+		// partial update wants the age queried before the region is set
+		eglQuerySurface(egl_display, surf->egl_surface, EGL_BUFFER_AGE_KHR, &age);
+		buffer_age_sum += age;
+		set_damage_region(egl_display, surf->egl_surface, damage_rect, 1);
+	}
+
+	glScissor(damage_rect[0], damage_rect[1], damage_rect[2], damage_rect[3]);
+	glEnable(GL_SCISSOR_TEST);
+}
+
+void setup_pacing(void)
+{
+	const char *ext = eglQueryString(egl_display, EGL_EXTENSIONS);
+
+	if (has_extension(ext, "EGL_ANDROID_get_frame_timestamps") &&
+	    eglSurfaceAttrib(egl_display, surfaces[0].egl_surface, EGL_TIMESTAMPS_ANDROID, EGL_TRUE)) {
+		get_next_frame_id = (PFNEGLGETNEXTFRAMEIDANDROIDPROC)
+			eglGetProcAddress("eglGetNextFrameIdANDROID");
+		get_frame_timestamps = (PFNEGLGETFRAMETIMESTAMPSANDROIDPROC)
+			eglGetProcAddress("eglGetFrameTimestampsANDROID");
+		if (!get_next_frame_id || !get_frame_timestamps)
+			get_next_frame_id = NULL;
+	}
+
+	printf("pacing: swap interval %d, %s\n", swap_interval,
+	       get_next_frame_id ? "display present times from EGL_ANDROID_get_frame_timestamps" :
+	       gles_version >= 3 ? "GPU completion times from fences" :
+	       "swap timestamps only");
+}
+
+// retire the frames that reached the display (or finished on the GPU),
+// what is left is the current queue depth
+void poll_pending(void)
+{
+	double t = now();
+	int done = 0, k;
+
+	while (done < num_pending) {
+		struct pending_frame *f = &pending[done];
+
+		if (get_next_frame_id) {
+			EGLint name = EGL_DISPLAY_PRESENT_TIME_ANDROID;
+			EGLnsecsANDROID value = EGL_TIMESTAMP_INVALID_ANDROID;
+
+			get_frame_timestamps(egl_display, surfaces[0].egl_surface, f->id, 1, &name, &value);
+			if (value == EGL_TIMESTAMP_PENDING_ANDROID)
+				break;
+			// the timestamps are CLOCK_MONOTONIC, like now()
+			if (value >= 0) {
+				present_latency_sum += value * 1e-9 - f->swapped;
+				present_latency_count++;
+			}
+		} else {
+			GLenum status = glClientWaitSync(f->fence, 0, 0);
+
+			if (status == GL_TIMEOUT_EXPIRED)
+				break;
+			glDeleteSync(f->fence);
+			present_latency_sum += t - f->swapped;
+			present_latency_count++;
+		}
+		done++;
+	}
+
+	for (k = done; k < num_pending; k++)
+		pending[k - done] = pending[k];
+	num_pending -= done;
+
+	queue_depth_sum += num_pending;
+	if (num_pending > queue_depth_max)
+		queue_depth_max = num_pending;
+	queue_samples++;
+}
+
+// records a step of the first surface's startup that began at start
+void startup_mark(const char *name, double start)
+{
+	double t = now();
+
+	if (!startup || startup_done || num_startup_steps == MAX_STARTUP_STEPS)
+		return;
+	startup_steps[num_startup_steps].name = name;
+	startup_steps[num_startup_steps].start = start - startup_t0;
+	startup_steps[num_startup_steps].end = t - startup_t0;
+	num_startup_steps++;
+}
+
+// the steps on a shared time axis, gaps between them are our own setup
+void report_startup(void)
+{
+	double total;
+	int k, j;
+
+	if (!startup || startup_done || num_startup_steps == 0)
+		return;
+	startup_done = true;
+	total = startup_steps[num_startup_steps - 1].end;
+
+	printf("startup waterfall (ms since main):\n");
+	for (k = 0; k < num_startup_steps; k++) {
+		const struct startup_step *s = &startup_steps[k];
+		int from = s->start / total * WATERFALL_WIDTH;
+		int to = s->end / total * WATERFALL_WIDTH;
+
+		if (to == from && to < WATERFALL_WIDTH)
+			to++;
+		printf("  %-24s %9.3f + %9.3f |", s->name, s->start * 1e3,
+		       (s->end - s->start) * 1e3);
+		for (j = 0; j < WATERFALL_WIDTH; j++)
+			putchar(j < from ? ' ' : j < to ? '#' : ' ');
+		printf("|\n");
+	}
+	printf("time to first frame: %f ms\n", total * 1e3);
+}
+
+void present_frame(struct surface *surf)
+{
+	struct pending_frame f = { 0, 0, 0. };
+	bool track = false;
+	double t1, t2;
+
+	if (pacing && get_next_frame_id)
+		track = get_next_frame_id(egl_display, surf->egl_surface, &f.id);
+	else if (pacing && gles_version >= 3) {
+		f.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		track = true;
+	}
+
+	// pbuffers have nothing to present, finishing stands in for the
+	// throttling a swap would do
+	if (surface_pbuffer) {
+		t1 = now();
+		glFinish();
+		if (startup && surf == &surfaces[0]) {
+			startup_mark("first glFinish", t1);
+			report_startup();
+		}
+		return;
+	}
+
+	t1 = now();
+	if (damage_fraction > 0. && !damage_full_phase && swap_with_damage)
+		swap_with_damage(egl_display, surf->egl_surface, damage_rect, 1);
+	else
+		eglSwapBuffers(egl_display, surf->egl_surface);
+	t2 = now();
+	if (startup && surf == &surfaces[0]) {
+		startup_mark("first eglSwapBuffers", t1);
+		report_startup();
+	}
+
+	if (!damage_fraction && !pacing)
+		return;
+
+	swap_dt += t2 - t1;
+	swaps++;
+
+	if (!pacing)
+		return;
+
+	if (last_swap > 0. && num_pace < MAX_PACE_SAMPLES) {
+		pace_intervals[num_pace] = t2 - last_swap;
+		pace_swap_calls[num_pace] = t2 - t1;
+		num_pace++;
+	}
+	last_swap = t2;
+
+	if (track) {
+		// a full queue means the oldest entry is lost, not waited for
+		if (num_pending == MAX_PENDING) {
+			if (pending[0].fence)
+				glDeleteSync(pending[0].fence);
+			memmove(pending, pending + 1, (MAX_PENDING - 1) * sizeof(*pending));
+			num_pending--;
+		}
+		f.swapped = t1;
+		pending[num_pending++] = f;
+	}
+	poll_pending();
+}
+
+int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void report_pacing(void)
+{
+	double mean = 0., var = 0., swap_call = 0., median, p99;
+	int missed = 0, k;
+
+	if (num_pace < 2)
+		return;
+
+	for (k = 0; k < num_pace; k++) {
+		mean += pace_intervals[k];
+		swap_call += pace_swap_calls[k];
+	}
+	mean /= num_pace;
+	for (k = 0; k < num_pace; k++)
+		var += (pace_intervals[k] - mean) * (pace_intervals[k] - mean);
+
+	qsort(pace_intervals, num_pace, sizeof(double), compare_double);
+	median = pace_intervals[num_pace / 2];
+	p99 = pace_intervals[num_pace * 99 / 100];
+
+	// the median interval is the deadline the display settled on
+	for (k = 0; k < num_pace; k++)
+		if (pace_intervals[k] > 1.5 * median)
+			missed++;
+
+	printf("pacing: interval %f ms (median %f, p99 %f), jitter %f ms, swap call %f ms, missed %d/%d\n",
+	       mean * 1e3, median * 1e3, p99 * 1e3, sqrt(var / num_pace) * 1e3,
+	       swap_call * 1e3 / num_pace, missed, num_pace);
+	if (present_latency_count)
+		printf("%s latency %f ms, queue depth %.1f (max %d)\n",
+		       get_next_frame_id ? "present" : "gpu completion",
+		       present_latency_sum * 1e3 / present_latency_count,
+		       (float)queue_depth_sum / queue_samples, queue_depth_max);
+
+	num_pace = 0;
+	present_latency_sum = 0.;
+	present_latency_count = 0;
+	queue_depth_sum = 0;
+	queue_depth_max = 0;
+	queue_samples = 0;
+}
+
+void setup_gpu_timing(void)
+{
+	const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+	GLint disjoint;
+	int k;
+
+	if (!has_extension(ext, "GL_EXT_disjoint_timer_query")) {
+		printf("gpu timing: GL_EXT_disjoint_timer_query not available, disabled\n");
+		gpu_timing = 0;
+		return;
+	}
+
+	gen_queries = (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+	begin_query = (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+	end_query = (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+	get_query_uiv = (PFNGLGETQUERYOBJECTUIVEXTPROC)eglGetProcAddress("glGetQueryObjectuivEXT");
+	get_query_ui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+	if (!gen_queries || !begin_query || !end_query || !get_query_uiv || !get_query_ui64v) {
+		printf("gpu timing: timer query entry points missing, disabled\n");
+		gpu_timing = 0;
+		return;
+	}
+
+	for (k = 0; k < GPU_QUERY_RING; k++)
+		gen_queries(GPU_PHASES, gpu_frames[k].queries);
+
+	// reading the flag clears it, start from a clean state
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	printf("gpu timing: %d frame query ring\n", GPU_QUERY_RING);
+}
+
+// pick the next ring slot and harvest what it measured GPU_QUERY_RING
+// frames ago; results that are still not there are dropped, not waited for
+void gpu_timing_frame(void)
+{
+	static int slot = 0;
+	struct gpu_frame *f = &gpu_frames[slot];
+	GLuint64 ns[GPU_PHASES];
+	bool ready[GPU_PHASES];
+	GLint disjoint;
+	int phase;
+
+	slot = (slot + 1) % GPU_QUERY_RING;
+	gpu_current = f;
+
+	for (phase = 0; phase < GPU_PHASES; phase++) {
+		GLuint available = 0;
+
+		ready[phase] = false;
+		if (!f->issued[phase])
+			continue;
+		f->issued[phase] = false;
+
+		get_query_uiv(f->queries[phase], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+		if (!available) {
+			gpu_dropped++;
+			continue;
+		}
+		get_query_ui64v(f->queries[phase], GL_QUERY_RESULT_EXT, &ns[phase]);
+		ready[phase] = true;
+	}
+
+	// a disjoint event (frequency change, context loss) voids the results
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	for (phase = 0; phase < GPU_PHASES; phase++) {
+		if (!ready[phase])
+			continue;
+		if (disjoint) {
+			gpu_dropped++;
+			continue;
+		}
+		gpu_time[phase] += ns[phase] * 1e-9;
+		gpu_samples[phase]++;
+	}
+}
+
+void gpu_query_begin(enum gpu_phase phase)
+{
+	if (gpu_timing)
+		begin_query(GL_TIME_ELAPSED_EXT, gpu_current->queries[phase]);
+}
+
+void gpu_query_end(enum gpu_phase phase)
+{
+	if (gpu_timing) {
+		end_query(GL_TIME_ELAPSED_EXT);
+		gpu_current->issued[phase] = true;
+	}
+}
+
+void report_gpu_timing(float upload_dt, int num_frames)
+{
+	printf("gpu time:");
+	if (gpu_samples[GPU_UPLOAD])
+		printf(" upload %f ms (cpu %f ms),", gpu_time[GPU_UPLOAD] * 1e3 / gpu_samples[GPU_UPLOAD],
+		       upload_dt * 1e3 / num_frames);
+	if (gpu_samples[GPU_DRAW])
+		printf(" draw %f ms,", gpu_time[GPU_DRAW] * 1e3 / gpu_samples[GPU_DRAW]);
+	printf(" %u results dropped\n", gpu_dropped);
+
+	memset(gpu_time, 0, sizeof(gpu_time));
+	memset(gpu_samples, 0, sizeof(gpu_samples));
+	gpu_dropped = 0;
+}
+
+GLuint upload_texture(struct surface *surf)
+{
+   // Texture object handle
+   GLuint textureId;
+
+   if (source_format == FORMAT_RGBA) {
+      // The upload path owns the texture and its unpack state
+      if (cpl_upload_init(&surf->up, upload_strategy, width, height, src_stride,
+                          unpack_alignment, pbo_depth) < 0)
+         exit(1);
+      if (copy_kernel)
+         surf->up.copy = copy_kernel;
+      textureId = surf->up.texture;
+   } else {
+      // Tightly packed data unless asked otherwise
+      glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+      // Generate a texture object
+      glGenTextures(1, &textureId);
+
+      // Bind the texture object
+      glBindTexture(GL_TEXTURE_2D, textureId);
+   }
+
+   if (source_format == FORMAT_NV12) {
+      // The chroma plane lives in its own texture on unit 1
+      glGenTextures(1, &surf->uv_texture_id);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, surf->uv_texture_id);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, textureId);
+   }
+
+   // Load the texture
+   upload_frame(surf, textures[0]);
+
+   // Set the filtering mode
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+   return textureId;
+}
+
+void render(struct surface *surf)
+{
+	// draw
+	if (!surf->donesetup) {
+		XWindowAttributes gwa;
+
+		if (surface_pbuffer)
+			glViewport(0, 0, width, height);
+		else {
+			XGetWindowAttributes(x_display, surf->win, &gwa);
+			glViewport(0, 0, gwa.width, gwa.height);
+		}
+		glClearColor(0.08, 0.06, 0.07, 1.);    // background color
+		surf->donesetup = 1;
+	}
+
+	if (gpu_timing)
+		gpu_timing_frame();
+
+	if (damage_fraction > 0. && !damage_full_phase)
+		begin_damage(surf);
+	else if (damage_fraction > 0.)
+		glDisable(GL_SCISSOR_TEST);
+
+	// Bind the texture
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, surf->texture_id);
+
+	if (upload) {
+		struct timezone tz;
+		struct timeval t1, t2;
+		struct producer *p;
+		const GLubyte *data = next_source(&surf->source_index, &p);
+		float dt;
+
+		gettimeofday(&t1, &tz);
+
+		// Load the texture
+		gpu_query_begin(GPU_UPLOAD);
+		if (dirty_rects || dirty_script)
+			upload_dirty(data);
+		else
+			upload_frame(surf, data);
+		gpu_query_end(GPU_UPLOAD);
+		gettimeofday(&t2, &tz);
+		dt = t2.tv_sec - t1.tv_sec + (t2.tv_usec - t1.tv_usec) * 1e-6;
+		surf->upload_dt += dt;
+		surf->total_upload_dt += dt;
+		if (!dirty_rects && !dirty_script) {
+			surf->upload_size += frame_bytes;
+			surf->total_upload += frame_bytes;
+		}
+
+		if (p)
+			release_frame(p);
+	}
+
+	// The chroma sampler reads texture unit 1
+	if (source_format == FORMAT_NV12) {
+		glUseProgram(surf->quad.program);
+		glUniform1i(surf->uv_sampler_loc, 1);
+	}
+
+	gpu_query_begin(GPU_DRAW);
+	cpl_quad_draw(&surf->quad, vtx, surf->texture_id);
+	gpu_query_end(GPU_DRAW);
+
+	if (readback != READBACK_NONE)
+		read_back();
+
+	// get the rendered buffer to the screen
+	present_frame(surf);
+	surf->frames++;
+	surf->total_frames++;
+}
+
+Window create_window(int index, const char *name)
+{
+	// get the root window (usually the whole screen)
+	Window root = DefaultRootWindow(x_display);
+	Window win;
+
+	XSetWindowAttributes swa;
+	swa.event_mask = ExposureMask | KeyPressMask;
+
+	// create a window with the provided parameters, extra surfaces cascade
+	win = XCreateWindow (
+		x_display, root,
+		index * 32, index * 32, width, height, 0,
+		CopyFromParent, InputOutput,
+		CopyFromParent, CWEventMask,
+		&swa);
+
+	XSetWindowAttributes xattr;
+
+	xattr.override_redirect = False;
+	XChangeWindowAttributes(x_display, win, CWOverrideRedirect, &xattr);
+
+	XWMHints hints;
+	hints.input = True;
+	hints.flags = InputHint;
+	XSetWMHints(x_display, win, &hints);
+
+	// make the window visible on the screen
+	XMapWindow(x_display, win);
+	XStoreName(x_display, win, name); // give the window a name
+
+	return win;
+}
+
+// values for the uniforms of the shader variants, q->program is in use
+void setup_shader_uniforms(const struct cpl_quad *q)
+{
+	// BT.709 RGB to YCbCr, limited range, alpha kept
+	static const GLfloat matrix[16] = {
+		 0.1826, -0.1006,  0.4392, 0.0,
+		 0.6142, -0.3386, -0.3989, 0.0,
+		 0.0620,  0.4392, -0.0403, 0.0,
+		 0.0,     0.0,     0.0,    1.0
+	};
+	static const GLfloat offset[4] = { 0.0625, 0.5, 0.5, 0.0 };
+	GLint loc;
+
+	if ((loc = glGetUniformLocation(q->program, "u_matrix")) >= 0)
+		glUniformMatrix4fv(loc, 1, GL_FALSE, matrix);
+	if ((loc = glGetUniformLocation(q->program, "u_offset")) >= 0)
+		glUniform4fv(loc, 1, offset);
+	if ((loc = glGetUniformLocation(q->program, "u_texel")) >= 0)
+		glUniform2f(loc, 1.0 / width, 1.0 / height);
+}
+
+// EGL surface, context, program and texture of one surface, its context
+// is left current
+void setup_surface(struct surface *surf, int index, const char *name)
+{
+	enum cpl_program_source program_source;
+	double t1;
+
+	pthread_mutex_init(&surf->lock, NULL);
+
+	if (surface_pbuffer) {
+		EGLint pbattr[] = {
+			EGL_WIDTH, width,
+			EGL_HEIGHT, height,
+			EGL_NONE
+		};
+		t1 = now();
+		surf->egl_surface = eglCreatePbufferSurface(egl_display, egl_config, pbattr);
+		if (index == 0)
+			startup_mark("eglCreatePbufferSurface", t1);
+	} else {
+		t1 = now();
+		surf->win = create_window(index, name);
+		// wait for the server, XMapWindow only queues the request
+		if (startup)
+			XSync(x_display, False);
+		if (index == 0)
+			startup_mark("window create/map", t1);
+		t1 = now();
+		surf->egl_surface = eglCreateWindowSurface(egl_display, egl_config, surf->win, NULL);
+		if (index == 0)
+			startup_mark("eglCreateWindowSurface", t1);
+	}
+	if (surf->egl_surface == EGL_NO_SURFACE) {
+		fprintf(stderr, "Unable to create EGL surface (eglError: %d)\n",
+			eglGetError());
+		exit(1);
+	}
+
+	// egl-contexts collect all state descriptions needed required for operation
+	// ask for GLES3 first, the GLES2 shaders run unchanged on it
+	EGLint ctxattr[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 3,
+		EGL_NONE
+	};
+	t1 = now();
+	surf->egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, ctxattr);
+	if (surf->egl_context == EGL_NO_CONTEXT) {
+		ctxattr[1] = 2;
+		surf->egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, ctxattr);
+	}
+	if (surf->egl_context == EGL_NO_CONTEXT) {
+		fprintf(stderr,
+			"Unable to create EGL context (eglError: %d)\n",
+			eglGetError());
+		exit(1);
+	}
+	if (index == 0)
+		startup_mark("eglCreateContext", t1);
+
+	// associate the egl-context with the egl-surface
+	t1 = now();
+	eglMakeCurrent(egl_display, surf->egl_surface, surf->egl_surface, surf->egl_context);
+	eglSwapInterval(egl_display, swap_interval);
+	if (index == 0)
+		startup_mark("eglMakeCurrent", t1);
+
+	gles_version = cpl_gles_version();
+
+	///////  the openGL part  /////////////////////////////////////
+
+	// compile and link the program, and select it for usage
+	t1 = now();
+	if (cpl_quad_init_cached(&surf->quad, source_format == FORMAT_NV12 ?
+				 fragment_nv12_src : shader->src, program_cache, &program_source) < 0)
+		exit(1);
+	if (index == 0)
+		startup_mark(program_source == CPL_PROGRAM_LOADED ? "program binary load" :
+			     "shader compile/link", t1);
+	if (index == 0)
+		printf("program: %s, %f ms\n", program_source_names[program_source],
+		       (now() - t1) * 1e3);
+	setup_shader_uniforms(&surf->quad);
+	if (source_format == FORMAT_NV12) {
+		surf->uv_sampler_loc = glGetUniformLocation(surf->quad.program, "s_uv");
+		if (surf->uv_sampler_loc < 0) {
+			fprintf(stderr, "Unable to get chroma sampler location\n");
+			exit(1);
+		}
+	}
+
+	// upload the texture
+	if (index == 0)
+		setup_unpack();
+	t1 = now();
+	surf->texture_id = upload_texture(surf);
+	if (index == 0)
+		startup_mark("first upload_texture", t1);
+
+	// spread the surfaces over the sources so they do not upload in lockstep
+	surf->source_index = index % num_textures;
+}
+
+void destroy_surface(struct surface *surf)
+{
+	eglDestroyContext(egl_display, surf->egl_context);
+	eglDestroySurface(egl_display, surf->egl_surface);
+	if (!surface_pbuffer)
+		XDestroyWindow(x_display, surf->win);
+	pthread_mutex_destroy(&surf->lock);
+}
+
+// with --surface-threads every surface renders from its own thread, the
+// main thread only handles events and reports
+void *surface_main(void *arg)
+{
+	struct surface *surf = arg;
+
+	eglMakeCurrent(egl_display, surf->egl_surface, surf->egl_surface, surf->egl_context);
+	while (!atomic_load(&surfaces_quit)) {
+		pthread_mutex_lock(&surf->lock);
+		render(surf);
+		pthread_mutex_unlock(&surf->lock);
+	}
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+	return NULL;
+}
+
+void start_surface_threads(void)
+{
+	int k;
+
+	// a context can only be current in one thread
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+	atomic_store(&surfaces_quit, false);
+	for (k = 0; k < num_surfaces; k++) {
+		if (pthread_create(&surfaces[k].thread, NULL, surface_main, &surfaces[k]) != 0) {
+			fprintf(stderr, "unable to start surface thread\n");
+			exit(1);
+		}
+	}
+}
+
+void stop_surface_threads(void)
+{
+	int k;
+
+	atomic_store(&surfaces_quit, true);
+	for (k = 0; k < num_surfaces; k++)
+		pthread_join(surfaces[k].thread, NULL);
+}
+
+// searches the upload paths on surface 0's context and writes the winner
+// to a profile the application (or --upload-profile) can load
+int run_autotune(void)
+{
+	struct cpl_profile best;
+
+	printf("autotune: %dx%d frames, %d byte rows, %.1f s budget\n", width, height,
+	       src_stride, autotune_budget);
+	if (cpl_autotune(&surfaces[0].quad, width, height, src_stride,
+			 (const GLubyte *const *)textures, num_textures, autotune_budget,
+			 true, &best) < 0) {
+		fprintf(stderr, "autotune found no working upload path\n");
+		return 1;
+	}
+
+	printf("fastest: %s, alignment %d", best.strategy->name, best.alignment);
+	if (best.pbo_depth)
+		printf(", %d buffers", best.pbo_depth);
+	if (best.copy)
+		printf(", %s", best.copy->name);
+	printf(", %f MiB/s\n", best.rate);
+
+	if (cpl_write_profile(autotune_output, &best) < 0)
+		return 1;
+	printf("profile written to %s\n", autotune_output);
+	return 0;
+}
+
+// draws texture into the bound framebuffer and reads it back
+void verify_draw(struct surface *surf, GLuint texture, GLubyte *out)
+{
+	glClear(GL_COLOR_BUFFER_BIT);
+	cpl_quad_draw(&surf->quad, vtx, texture);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, out);
+}
+
+// GL reads back bottom-up, the cpu renderer writes top-down
+bool verify_compare(const char *name, const GLubyte *ref, const GLubyte *out,
+		    bool flip, int tolerance)
+{
+	int x, y, c, max_diff = 0, off = 0;
+
+	for (y = 0; y < height; y++) {
+		const GLubyte *a = ref + y * width * 4;
+		const GLubyte *b = out + (flip ? height - 1 - y : y) * width * 4;
+
+		for (x = 0; x < width; x++) {
+			int diff = 0;
+
+			for (c = 0; c < 4; c++) {
+				int d = abs(a[x * 4 + c] - b[x * 4 + c]);
+				if (d > diff)
+					diff = d;
+			}
+			if (diff > tolerance)
+				off++;
+			if (diff > max_diff)
+				max_diff = diff;
+		}
+	}
+
+	printf("  %-36s max diff %3d, %6d pixels off: %s\n", name, max_diff, off,
+	       off ? "FAIL" : "ok");
+	return off == 0;
+}
+
+// every upload path, alignment, dirty rect tiling and the cpu renderer,
+// at every rotation and filter, against glTexImage2D of tightly packed rows
+int run_verify(struct surface *surf)
+{
+	static GLfloat *const arrays[] = { vertexArray, vertexArray90, vertexArray180, vertexArray270 };
+	static const GLint filters[] = { GL_NEAREST, GL_LINEAR };
+	struct cpl_upload_config configs[64];
+	const GLubyte *src = textures[1 % num_textures], *prev = textures[0];
+	GLubyte *tight, *ref, *out;
+	GLuint fbo, target;
+	int num_configs, rot, f, k, y, checks = 0, failed = 0;
+	char name[64];
+
+	tight = malloc(width * height * 4);
+	ref = malloc(width * height * 4);
+	out = malloc(width * height * 4);
+	if (tight == NULL || ref == NULL || out == NULL) {
+		fprintf(stderr, "unable to allocate verify buffers\n");
+		return 1;
+	}
+	for (y = 0; y < height; y++)
+		memcpy(tight + y * width * 4, src + y * src_stride, width * 4);
+
+	// an offscreen target keeps the window system's formats out of it
+	glGenTextures(1, &target);
+	glBindTexture(GL_TEXTURE_2D, target);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "verify framebuffer is incomplete\n");
+		return 1;
+	}
+	glViewport(0, 0, width, height);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	dirty_repack = gles_version < 3;
+	if (dirty_repack && (repack_buf = malloc(width * height * 4)) == NULL) {
+		fprintf(stderr, "unable to allocate repack buffer\n");
+		return 1;
+	}
+
+	num_configs = cpl_upload_configs(width, height, src_stride, configs, 64);
+	printf("verify: %dx%d, %d byte rows, %d upload configurations\n", width, height,
+	       src_stride, num_configs);
+
+	for (rot = 0; rot < 4; rot++) {
+		vtx = arrays[rot];
+		tex = arrays[rot] + 3;
+
+		for (f = 0; f < 2; f++) {
+			struct cpl_upload u;
+
+			filter = filters[f];
+			printf("rotation %d, %s:\n", rot * 90, filter == GL_LINEAR ? "linear" : "nearest");
+
+			// the reference: the plain glTexImage2D path
+			if (cpl_upload_init(&u, &cpl_upload_teximage, width, height, width * 4, 1, 0) < 0)
+				return 1;
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+			cpl_upload_frame(&u, tight);
+			verify_draw(surf, u.texture, ref);
+
+			// dirty rects: odd sized tiles over an older frame
+			cpl_upload_frame(&u, prev);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			if (!dirty_repack)
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, src_stride / 4);
+			for (y = 0; y < height; y += 23) {
+				int x;
+				for (x = 0; x < width; x += 37) {
+					struct rect r = { x, y, 37, 23 };
+					if (x + r.w > width)
+						r.w = width - x;
+					if (y + r.h > height)
+						r.h = height - y;
+					upload_rect(src, &r);
+				}
+			}
+			if (!dirty_repack)
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			verify_draw(surf, u.texture, out);
+			failed += !verify_compare(dirty_repack ? "dirty rects, cpu repack" :
+						  "dirty rects, row length", ref, out, false,
+						  VERIFY_TOLERANCE_GL);
+			checks++;
+			cpl_upload_fini(&u);
+
+			for (k = 0; k < num_configs; k++) {
+				if (cpl_upload_init(&u, configs[k].strategy, width, height, src_stride,
+						    configs[k].alignment, configs[k].pbo_depth) < 0)
+					return 1;
+				if (configs[k].copy)
+					u.copy = configs[k].copy;
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+				// twice, so ring buffers are reused at least once
+				cpl_upload_frame(&u, prev);
+				cpl_upload_frame(&u, src);
+				verify_draw(surf, u.texture, out);
+				cpl_upload_fini(&u);
+
+				if (configs[k].pbo_depth)
+					snprintf(name, sizeof(name), "%s, %d buffers, %s",
+						 configs[k].strategy->name, configs[k].pbo_depth,
+						 configs[k].copy->name);
+				else if (configs[k].copy)
+					snprintf(name, sizeof(name), "%s, %s",
+						 configs[k].strategy->name, configs[k].copy->name);
+				else
+					snprintf(name, sizeof(name), "%s, alignment %d",
+						 configs[k].strategy->name, configs[k].alignment);
+				failed += !verify_compare(name, ref, out, false, VERIFY_TOLERANCE_GL);
+				checks++;
+			}
+
+			// the cpu renderer draws the same quad
+			memset(out, 0, width * height * 4);
+			start_blitter(out, width * 4);
+			blit_frame(src);
+			stop_blitter();
+			snprintf(name, sizeof(name), "cpu renderer, %d threads", blit_threads);
+			// turned non-square frames are scaled, and nearest samples that
+			// land exactly on a texel edge may go either way on the GPU
+			if (filter == GL_NEAREST && width != height && rot % 2) {
+				printf("  %-36s skipped, samples on texel edges\n", name);
+				continue;
+			}
+			failed += !verify_compare(name, ref, out, true, filter == GL_LINEAR ?
+						  VERIFY_TOLERANCE_CPU_LINEAR :
+						  VERIFY_TOLERANCE_CPU_NEAREST);
+			checks++;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &target);
+	free(tight);
+	free(ref);
+	free(out);
+
+	printf("verify: %d of %d checks failed\n", failed, checks);
+	return failed ? 1 : 0;
+}
+
+// sequential and random writes, reads and read-modify-writes of whole
+// pixels over a mapping of len bytes
+void probe_mapping(void *map, size_t len, struct map_rates *r)
+{
+	uint32_t *p = map;
+	size_t n = len / 4, k;
+	uint32_t x = 1;
+	double t1, t, bytes;
+
+	t1 = now();
+	bytes = 0.;
+	do {
+		memset(map, (int)bytes, len);
+		bytes += len;
+		t = now();
+	} while (t - t1 < MAP_PROBE_TIME);
+	r->seq_write = bytes / ((t - t1) * 1024. * 1024.);
+
+	// single pixels all over the buffer, write combining has nothing to combine
+	t1 = now();
+	bytes = 0.;
+	do {
+		for (k = 0; k < n; k++) {
+			x = x * 1664525 + 1013904223;
+			p[(uint64_t)x * n >> 32] = x;
+		}
+		bytes += n * 4;
+		t = now();
+	} while (t - t1 < MAP_PROBE_TIME);
+	r->random_write = bytes / ((t - t1) * 1024. * 1024.);
+
+	t1 = now();
+	bytes = 0.;
+	do {
+		map_probe_sink += read_buffer(map, len);
+		bytes += len;
+		t = now();
+	} while (t - t1 < MAP_PROBE_TIME);
+	r->read = bytes / ((t - t1) * 1024. * 1024.);
+
+	// invert the colors in place
+	t1 = now();
+	bytes = 0.;
+	do {
+		for (k = 0; k < n; k++)
+			p[k] ^= 0x00ffffff;
+		bytes += n * 4;
+		t = now();
+	} while (t - t1 < MAP_PROBE_TIME);
+	r->rmw = bytes / ((t - t1) * 1024. * 1024.);
+}
+
+// what the rates say about the mapping, relative to malloc'ed memory
+const char *map_caching(const struct map_rates *r, const struct map_rates *ref)
+{
+	if (r->read >= ref->read / 4)
+		return "cached, pixel operations in place are fine";
+	if (r->seq_write >= ref->seq_write / 4 &&
+	    r->random_write / r->seq_write < ref->random_write / ref->seq_write / 4)
+		return "write-combined, write whole rows in order and never read back";
+	return "uncached, do pixel operations in cached memory and copy the result";
+}
+
+void report_mapping(const char *name, const struct map_rates *r, const struct map_rates *ref)
+{
+	printf("  %-28s %10.1f %10.1f %10.1f %10.1f\n", name, r->seq_write, r->random_write,
+	       r->read, r->rmw);
+	if (ref)
+		printf("  %-28s %s\n", "", map_caching(r, ref));
+}
+
+void probe_pbo(const char *name, GLenum target, GLenum usage, const struct map_rates *ref)
+{
+	struct map_rates r;
+	GLuint pbo;
+	void *map;
+
+	glGenBuffers(1, &pbo);
+	glBindBuffer(target, pbo);
+	glBufferData(target, frame_bytes, NULL, usage);
+	map = glMapBufferRange(target, 0, frame_bytes, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+	if (map == NULL)
+		printf("  %-28s unable to map (glError: %x)\n", name, glGetError());
+	else {
+		probe_mapping(map, frame_bytes, &r);
+		glUnmapBuffer(target);
+		report_mapping(name, &r, ref);
+	}
+	glBindBuffer(target, 0);
+	glDeleteBuffers(1, &pbo);
+}
+
+// a buffer from each dma-buf heap, mapped for the CPU inside a sync
+void probe_dma_heaps(const struct map_rates *ref)
+{
+	DIR *dir = opendir("/dev/dma_heap");
+	struct dirent *e;
+
+	if (dir == NULL) {
+		printf("  %-28s no /dev/dma_heap\n", "dma-buf");
+		return;
+	}
+	while ((e = readdir(dir)) != NULL) {
+		struct dma_heap_allocation_data alloc = {
+			.len = frame_bytes, .fd_flags = O_RDWR | O_CLOEXEC
+		};
+		struct dma_buf_sync sync;
+		struct map_rates r;
+		char path[300], name[64];
+		void *map;
+		int heap;
+
+		if (e->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/dev/dma_heap/%s", e->d_name);
+		snprintf(name, sizeof(name), "dma-buf %s", e->d_name);
+		heap = open(path, O_RDONLY | O_CLOEXEC);
+		if (heap < 0 || ioctl(heap, DMA_HEAP_IOCTL_ALLOC, &alloc) < 0) {
+			printf("  %-28s unable to allocate: %s\n", name, strerror(errno));
+			if (heap >= 0)
+				close(heap);
+			continue;
+		}
+		close(heap);
+
+		map = mmap(NULL, frame_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, alloc.fd, 0);
+		if (map == MAP_FAILED) {
+			printf("  %-28s unable to map: %s\n", name, strerror(errno));
+			close(alloc.fd);
+			continue;
+		}
+		sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
+		ioctl(alloc.fd, DMA_BUF_IOCTL_SYNC, &sync);
+		probe_mapping(map, frame_bytes, &r);
+		sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+		ioctl(alloc.fd, DMA_BUF_IOCTL_SYNC, &sync);
+		munmap(map, frame_bytes);
+		close(alloc.fd);
+		report_mapping(name, &r, ref);
+	}
+	closedir(dir);
+}
+
+// the same pixel operations on ordinary memory and on every kind of GPU
+// mapping we can get, to tell which ones may be read or modified in place
+int run_map_probe(void)
+{
+	struct map_rates ref;
+	void *buf;
+
+	if (posix_memalign(&buf, 64, frame_bytes) != 0) {
+		fprintf(stderr, "unable to allocate probe buffer\n");
 		return 1;
 	}
+	printf("mapping probe, %zu byte buffers (MiB/s):\n", frame_bytes);
+	printf("  %-28s %10s %10s %10s %10s\n", "", "seq write", "rand write", "read", "rmw");
+	probe_mapping(buf, frame_bytes, &ref);
+	report_mapping("malloc (reference)", &ref, NULL);
+	free(buf);
+
+	if (gles_version >= 3) {
+		probe_pbo("pbo unpack, stream draw", GL_PIXEL_UNPACK_BUFFER, GL_STREAM_DRAW, &ref);
+		probe_pbo("pbo pack, stream read", GL_PIXEL_PACK_BUFFER, GL_STREAM_READ, &ref);
+	} else
+		printf("  %-28s needs GLES 3\n", "pbo");
+	probe_dma_heaps(&ref);
+	return 0;
+}
+
+// fill rate of every shader variant drawing the same texture; a variant
+// close to the plain fetch is bandwidth bound, a slower one ALU or
+// sampler bound
+int run_shader_matrix(struct surface *surf)
+{
+	struct cpl_quad base = surf->quad;
+	double baseline = 0.;
+	GLint range[2], precision;
+	int k;
+
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &precision);
+
+	printf("shader variants, %dx%d, %.1f s each:\n", width, height, SHADER_TIME);
+	for (k = 0; shader_variants[k].name; k++) {
+		const struct shader_variant *v = &shader_variants[k];
+		unsigned long long frames = 0;
+		double t1, t, rate;
+
+		if (v->src && strstr(v->src, "highp") && precision == 0) {
+			printf("  %-14s not supported in the fragment stage\n", v->name);
+			continue;
+		}
+		if (cpl_quad_init_cached(&surf->quad, v->src, program_cache, NULL) < 0) {
+			printf("  %-14s failed to build\n", v->name);
+			continue;
+		}
+		setup_shader_uniforms(&surf->quad);
+
+		// one frame to get the program compiled for real
+		cpl_quad_draw(&surf->quad, vtx, surf->texture_id);
+		glFinish();
+		if (num_energy_sensors)
+			read_energy();
+
+		t1 = now();
+		do {
+			cpl_quad_draw(&surf->quad, vtx, surf->texture_id);
+			present_frame(surf);
+			frames++;
+			t = now();
+		} while (t - t1 < SHADER_TIME);
+		glFinish();
+		t = now();
+		cpl_quad_fini(&surf->quad);
+
+		rate = (frames * width * height * 4) / ((t - t1) * 1024. * 1024.);
+		if (k == 0)
+			baseline = rate;
+		printf("  %-14s fps %10.1f, fill rate %10.1f MiB/s, %.0f Mpixel/s", v->name,
+		       frames / (t - t1), rate, frames * width * height / ((t - t1) * 1e6));
+		if (baseline > 0.)
+			printf(", %.0f%% of %s", 100. * rate / baseline, shader_variants[0].name);
+		printf("\n");
+		report_energy(frames, t - t1, 0., frames * width * height * 4.);
+	}
+
+	surf->quad = base;
+	return 0;
+}
+
+// per-surface and aggregate rates; the aggregate is taken over wall-clock
+// time, so it shows what the driver sustains with all surfaces busy
+void report_surfaces(float dt)
+{
+	unsigned long long frames = 0, bytes = 0;
+	int k;
+
+	for (k = 0; k < num_surfaces; k++) {
+		struct surface *surf = &surfaces[k];
+		unsigned int n, size;
+		float udt;
+
+		pthread_mutex_lock(&surf->lock);
+		n = surf->frames;
+		size = surf->upload_size;
+		udt = surf->upload_dt;
+		surf->frames = 0;
+		surf->upload_size = 0;
+		surf->upload_dt = 0.;
+		pthread_mutex_unlock(&surf->lock);
+
+		printf("surface %d: fps %f", k, n / dt);
+		if (upload && n)
+			printf(", texture upload rate %f MiB/s (%f ms/frame)",
+			       size / (udt * 1024. * 1024.), udt * 1e3 / n);
+		printf("\n");
+		frames += n;
+		bytes += size;
+	}
+
+	printf("%d %s surfaces, %s: total fps %f\n", num_surfaces,
+	       surface_pbuffer ? "pbuffer" : "window",
+	       surface_threads ? "one thread each" : "one thread switching contexts",
+	       frames / dt);
+	if (fillrate)
+		printf("aggregate fill rate: %f MiB/s\n",
+		       (frames * width * height * 4) / (dt * 1024. * 1024.));
+	if (upload) {
+		double ceiling = surface_threads ? memcpy_ceiling_mt : memcpy_ceiling;
+
+		printf("aggregate texture upload rate: %f MiB/s", bytes / (dt * 1024. * 1024.));
+		if (ceiling > 0.)
+			printf(", %.0f%% of memcpy", 100. * bytes / (dt * 1024. * 1024.) / ceiling);
+		printf("\n");
+	}
+	report_energy(frames, dt, upload ? bytes : 0., fillrate ? frames * width * height * 4. : 0.);
+	check_cpufreq();
+}
+
+
+/////////////////////////////////////////////////////////////////////
+
+
+int main(int argc, char **argv)
+{
+	int c;
+	int help = 0;
+	double step_start;
+
+	startup_t0 = now();
+
+	while (1) {
+		int option_index = 0;
+		struct option long_options[] = {
+			{"help",     no_argument,       &help,      1 },
+			{"upload",   no_argument,       &upload,    1 },
+			{"fillrate", no_argument,       &fillrate,  1 },
+			{"rotate",   required_argument, 0,          0 },
+			{"size",     required_argument, 0,          0 },
+			{"source-pool-bytes", required_argument, 0, 0 },
+			{"cache-flush", no_argument,    &cache_flush, 1 },
+			{"source-alloc", required_argument, 0,      0 },
+			{"numa-node", required_argument, 0,         0 },
+			{"source-file", required_argument, 0,       0 },
+			{"source-format", required_argument, 0,     0 },
+			{"source-populate", no_argument, &source_populate, 1 },
+			{"source-readahead", no_argument, &source_readahead, 1 },
+			{"producers", required_argument, 0,         0 },
+			{"producer-depth", required_argument, 0,    0 },
+			{"helper-cpus", required_argument, 0,       0 },
+			{"render-cpu", required_argument, 0,        0 },
+			{"sched-fifo", required_argument, 0,        0 },
+			{"renderer", required_argument, 0,          0 },
+			{"filter",   required_argument, 0,          0 },
+			{"blit-threads", required_argument, 0,      0 },
+			{"present",  required_argument, 0,          0 },
+			{"readback", required_argument, 0,          0 },
+			{"readback-depth", required_argument, 0,    0 },
+			{"readback-native", no_argument, &readback_native, 1 },
+			{"dirty-rects", required_argument, 0,       0 },
+			{"dirty-fraction", required_argument, 0,    0 },
+			{"dirty-script", required_argument, 0,      0 },
+			{"dirty-repack", no_argument, &dirty_repack, 1 },
+			{"stride-pad", required_argument, 0,        0 },
+			{"stride-align", required_argument, 0,      0 },
+			{"unpack-alignment", required_argument, 0,  0 },
+			{"damage",   required_argument, 0,          0 },
+			{"swap-interval", required_argument, 0,     0 },
+			{"gpu-timing", no_argument,     &gpu_timing, 1 },
+			{"surfaces", required_argument, 0,          0 },
+			{"surface-threads", no_argument, &surface_threads, 1 },
+			{"surface-type", required_argument, 0,      0 },
+			{"processes", required_argument, 0,         0 },
+			{"upload-path", required_argument, 0,       0 },
+			{"upload-profile", required_argument, 0,    0 },
+			{"autotune", no_argument,       &autotune,  1 },
+			{"verify",   no_argument,       &verify,    1 },
+			{"map-probe", no_argument,      &map_probe, 1 },
+			{"shader",   required_argument, 0,          0 },
+			{"program-cache", required_argument, 0,     0 },
+			{"startup",  no_argument,       &startup,   1 },
+			{"energy",   no_argument,       &energy,    1 },
+			{"calibrate", no_argument,      &calibrate, 1 },
+			{"calibrate-threads", required_argument, 0, 0 },
+			{"autotune-budget", required_argument, 0,   0 },
+			{"autotune-output", required_argument, 0,   0 },
+			{"pbo-depth", required_argument, 0,         0 },
+			{"copy-kernel", required_argument, 0,       0 },
+			{"duration", required_argument, 0,          0 },
+			{0,          0,                 0,          0 }
+		};
+
+		c = getopt_long_only(argc, argv, "", long_options,
+				     &option_index);
+		if (c == -1)
+			break;
 
-	egl_surface = eglCreateWindowSurface(egl_display, ecfg, win, NULL);
-	if (egl_surface == EGL_NO_SURFACE) {
-		fprintf(stderr, "Unable to create EGL surface (eglError: %d)\n",
-			eglGetError());
-		return 1;
+		switch (c) {
+		case 0:
+			if (strcmp(long_options[option_index].name, "rotate") == 0) {
+				int rot = atoi(optarg);
+				switch(rot) {
+				case 90:
+					vtx = &vertexArray90[0];
+					tex = &vertexArray90[3];
+					break;
+				case 180:
+					vtx = &vertexArray180[0];
+					tex = &vertexArray180[3];
+					break;
+				case 270:
+					vtx = &vertexArray270[0];
+					tex = &vertexArray270[3];
+					break;
+				default:
+					printf("invalid rotation, must be one of: 90, 180, 270\n");
+					exit(1);
+					break;
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "size") == 0) {
+				// any WxH is accepted here, but only 256 and 512
+				// have built-in images
+				int w, h;
+				switch (sscanf(optarg, "%dx%d", &w, &h)) {
+				case 1:
+					h = w;
+					// fall through
+				case 2:
+					if (w > 0 && h > 0 && w % 2 == 0 && h % 2 == 0) {
+						width = w;
+						height = h;
+						break;
+					}
+					// fall through
+				default:
+					printf("invalid size, must be N or WxH\n");
+					exit(1);
+					break;
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "source-pool-bytes") == 0) {
+				if (strcmp(optarg, "auto") == 0)
+					source_pool_bytes = (size_t)-1;
+				else
+					source_pool_bytes = parse_size(optarg);
+				if (source_pool_bytes == 0) {
+					printf("invalid source pool size, must be a byte count (K/M/G suffix allowed) or auto\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "source-alloc") == 0) {
+				unsigned int k;
+				for (k = ALLOC_MALLOC; k <= ALLOC_THP; k++)
+					if (strcmp(optarg, source_alloc_names[k]) == 0)
+						source_alloc = k;
+				if (strcmp(optarg, source_alloc_names[source_alloc]) != 0) {
+					printf("invalid source alloc, must be one of: malloc, align64, align4k, hugetlb, thp\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "numa-node") == 0) {
+				numa_node = atoi(optarg);
+				if (numa_node < 0) {
+					printf("invalid numa node\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "source-file") == 0) {
+				source_file = optarg;
+			}
+			else if (strcmp(long_options[option_index].name, "source-format") == 0) {
+				if (strcmp(optarg, "rgba") == 0)
+					source_format = FORMAT_RGBA;
+				else if (strcmp(optarg, "nv12") == 0)
+					source_format = FORMAT_NV12;
+				else {
+					printf("invalid source format, must be one of: rgba, nv12\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "producers") == 0) {
+				num_producers = atoi(optarg);
+				if (num_producers < 1) {
+					printf("invalid producer count\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "producer-depth") == 0) {
+				int depth = atoi(optarg);
+				if (depth < 1) {
+					printf("invalid producer ring depth\n");
+					exit(1);
+				}
+				producer_depth = depth;
+			}
+			else if (strcmp(long_options[option_index].name, "helper-cpus") == 0) {
+				num_helper_cpus = parse_cpu_list(optarg, helper_cpus, MAX_CPUS);
+				if (num_helper_cpus == 0) {
+					printf("invalid cpu list, must be like 0,2-3 with cpus below %d\n",
+					       CPU_SETSIZE);
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "render-cpu") == 0) {
+				render_cpu = atoi(optarg);
+				// the same bound as the helper cpus, cpu_set_t's
+				if (render_cpu < 0 || render_cpu >= CPU_SETSIZE) {
+					printf("invalid render cpu, must be below %d\n", CPU_SETSIZE);
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "sched-fifo") == 0) {
+				sched_fifo_prio = atoi(optarg);
+				if (sched_fifo_prio < sched_get_priority_min(SCHED_FIFO) ||
+				    sched_fifo_prio > sched_get_priority_max(SCHED_FIFO)) {
+					printf("invalid SCHED_FIFO priority, must be %d..%d\n",
+					       sched_get_priority_min(SCHED_FIFO),
+					       sched_get_priority_max(SCHED_FIFO));
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "renderer") == 0) {
+				if (strcmp(optarg, "gl") == 0)
+					renderer = RENDERER_GL;
+				else if (strcmp(optarg, "cpu") == 0)
+					renderer = RENDERER_CPU;
+				else {
+					printf("invalid renderer, must be one of: gl, cpu\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "filter") == 0) {
+				if (strcmp(optarg, "nearest") == 0)
+					filter = GL_NEAREST;
+				else if (strcmp(optarg, "linear") == 0)
+					filter = GL_LINEAR;
+				else {
+					printf("invalid filter, must be one of: nearest, linear\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "present") == 0) {
+				if (strcmp(optarg, "gl") == 0)
+					present = PRESENT_GL;
+				else if (strcmp(optarg, "xshm") == 0)
+					present = PRESENT_XSHM;
+				else {
+					printf("invalid present mode, must be one of: gl, xshm\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "readback") == 0) {
+				if (strcmp(optarg, "sync") == 0)
+					readback = READBACK_SYNC;
+				else if (strcmp(optarg, "pbo") == 0)
+					readback = READBACK_PBO;
+				else {
+					printf("invalid readback mode, must be one of: sync, pbo\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "readback-depth") == 0) {
+				readback_depth = atoi(optarg);
+				if (readback_depth < 1) {
+					printf("invalid readback ring depth\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "dirty-rects") == 0) {
+				dirty_rects = atoi(optarg);
+				if (dirty_rects < 1 || dirty_rects > 256) {
+					printf("invalid dirty rect count, must be 1..256\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "dirty-fraction") == 0) {
+				dirty_fraction = atof(optarg);
+				if (dirty_fraction <= 0. || dirty_fraction > 1.) {
+					printf("invalid dirty fraction, must be in (0, 1]\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "dirty-script") == 0) {
+				dirty_script = optarg;
+			}
+			else if (strcmp(long_options[option_index].name, "stride-pad") == 0) {
+				stride_pad = atoi(optarg);
+				if (stride_pad < 0 || stride_pad % 4 != 0) {
+					printf("invalid stride padding, must be a multiple of 4 bytes\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "stride-align") == 0) {
+				stride_align = atoi(optarg);
+				if (stride_align < 4 || stride_align % 4 != 0) {
+					printf("invalid stride alignment, must be a multiple of 4 bytes\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "unpack-alignment") == 0) {
+				unpack_alignment = atoi(optarg);
+				unpack_alignment_given = true;
+				if (unpack_alignment != 1 && unpack_alignment != 2 &&
+				    unpack_alignment != 4 && unpack_alignment != 8) {
+					printf("invalid unpack alignment, must be one of: 1, 2, 4, 8\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "damage") == 0) {
+				damage_fraction = atof(optarg);
+				if (damage_fraction <= 0. || damage_fraction > 1.) {
+					printf("invalid damaged fraction, must be in (0, 1]\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "swap-interval") == 0) {
+				swap_interval = atoi(optarg);
+				if (swap_interval < 0) {
+					printf("invalid swap interval\n");
+					exit(1);
+				}
+				pacing = true;
+			}
+			else if (strcmp(long_options[option_index].name, "surfaces") == 0) {
+				num_surfaces = atoi(optarg);
+				if (num_surfaces < 1) {
+					printf("invalid surface count\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "upload-path") == 0) {
+				upload_strategy = cpl_find_upload_strategy(optarg);
+				if (upload_strategy == NULL) {
+					int k;
+					printf("invalid upload path, must be one of:");
+					for (k = 0; cpl_upload_strategies[k]; k++)
+						printf(" %s", cpl_upload_strategies[k]->name);
+					printf("\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "calibrate-threads") == 0) {
+				calibrate_threads = atoi(optarg);
+				if (calibrate_threads < 1) {
+					printf("invalid calibration thread count\n");
+					exit(1);
+				}
+				calibrate = 1;
+			}
+			else if (strcmp(long_options[option_index].name, "upload-profile") == 0) {
+				upload_profile = optarg;
+			}
+			else if (strcmp(long_options[option_index].name, "autotune-budget") == 0) {
+				autotune_budget = atof(optarg);
+				if (autotune_budget <= 0.) {
+					printf("invalid autotune budget\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "autotune-output") == 0) {
+				autotune_output = optarg;
+			}
+			else if (strcmp(long_options[option_index].name, "pbo-depth") == 0) {
+				pbo_depth = atoi(optarg);
+				if (pbo_depth < 1) {
+					printf("invalid pixel buffer count\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "program-cache") == 0) {
+				program_cache = optarg;
+			}
+			else if (strcmp(long_options[option_index].name, "shader") == 0) {
+				if (strcmp(optarg, "all") == 0)
+					shader_all = true;
+				else {
+					for (shader = shader_variants; shader->name; shader++)
+						if (strcmp(shader->name, optarg) == 0)
+							break;
+					if (shader->name == NULL) {
+						printf("invalid shader, must be all or one of:");
+						for (shader = shader_variants; shader->name; shader++)
+							printf(" %s", shader->name);
+						printf("\n");
+						exit(1);
+					}
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "copy-kernel") == 0) {
+				if (strcmp(optarg, "all") == 0)
+					copy_kernel_all = true;
+				else {
+					copy_kernel = cpl_find_copy_kernel(optarg);
+					if (copy_kernel == NULL || !copy_kernel->supported()) {
+						int k;
+						printf("invalid copy kernel, must be all or one of:");
+						for (k = 0; cpl_copy_kernels[k].name; k++)
+							if (cpl_copy_kernels[k].supported())
+								printf(" %s", cpl_copy_kernels[k].name);
+						printf("\n");
+						exit(1);
+					}
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "processes") == 0) {
+				num_processes = atoi(optarg);
+				if (num_processes < 1) {
+					printf("invalid process count\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "duration") == 0) {
+				duration = atoi(optarg);
+				if (duration < 1) {
+					printf("invalid duration, must be a whole number of seconds\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "surface-type") == 0) {
+				if (strcmp(optarg, "window") == 0)
+					surface_pbuffer = 0;
+				else if (strcmp(optarg, "pbuffer") == 0)
+					surface_pbuffer = 1;
+				else {
+					printf("invalid surface type, must be one of: window, pbuffer\n");
+					exit(1);
+				}
+			}
+			else if (strcmp(long_options[option_index].name, "blit-threads") == 0) {
+				blit_threads = atoi(optarg);
+				if (blit_threads < 1) {
+					printf("invalid blitter thread count\n");
+					exit(1);
+				}
+			}
+			break;
+
+		case '?':
+			help = 1;
+			break;
+
+		default:
+			printf("?? getopt returned character code 0%o ??\n", c);
+		}
 	}
 
-	// egl-contexts collect all state descriptions needed required for operation
-	EGLint ctxattr[] = {
-		EGL_CONTEXT_CLIENT_VERSION, 2,
-		EGL_NONE
-	};
-	egl_context = eglCreateContext(egl_display, ecfg, EGL_NO_CONTEXT, ctxattr);
-	if (egl_context == EGL_NO_CONTEXT) {
-		fprintf(stderr,
-			"Unable to create EGL context (eglError: %d)\n",
-			eglGetError());
-		return 1;
+	if (help || fillrate + upload + (readback != READBACK_NONE) + autotune + verify + map_probe != 1) {
+		printf("usage: %s: [ --rotate 90|180|270 ] [ --size 256|512|WxH ]\n"
+		       "       [--fillrate|--upload|--readback sync|pbo|--autotune|--verify|--map-probe]\n"
+		       "       [ --source-pool-bytes N|auto ] [ --cache-flush ]\n"
+		       "       [ --source-alloc malloc|align64|align4k|hugetlb|thp ] [ --numa-node N ]\n"
+		       "       [ --source-file FILE [ --source-format rgba|nv12 ] [ --source-populate ] [ --source-readahead ] ]\n"
+		       "       [ --producers N [ --producer-depth N ] ] [ --helper-cpus LIST ]\n"
+		       "       [ --render-cpu N ] [ --sched-fifo PRIO ]\n"
+		       "       [ --renderer gl|cpu ] [ --filter nearest|linear ] [ --blit-threads N ]\n"
+		       "       [ --present gl|xshm ] [ --readback-depth N ] [ --readback-native ]\n"
+		       "       [ --dirty-rects K [ --dirty-fraction F ] | --dirty-script FILE ] [ --dirty-repack ]\n"
+		       "       [ --stride-pad BYTES ] [ --stride-align BYTES ] [ --unpack-alignment 1|2|4|8 ]\n"
+		       "       [ --damage F ] [ --swap-interval N ] [ --gpu-timing ]\n"
+		       "       [ --surfaces N [ --surface-threads ] ] [ --surface-type window|pbuffer ]\n"
+		       "       [ --processes N ] [ --duration SECONDS ]\n"
+		       "       [ --upload-path teximage|row-length|repack|texsubimage|pbo [ --pbo-depth N ] ]\n"
+		       "       [ --copy-kernel all|memcpy|prefetch|rep-movsb|sse2-nt|avx2-nt|neon|... ]\n"
+		       "       [ --upload-profile FILE ] [ --autotune-budget SECONDS ] [ --autotune-output FILE ]\n"
+		       "       [ --energy ] [ --calibrate [ --calibrate-threads N ] ]\n"
+		       "       [ --shader all|mediump|highp|color-matrix|multi-tap|premultiply ]\n"
+		       "       [ --program-cache DIR ] [ --startup ]\n",
+		       basename(argv[0]));
+		exit(0);
 	}
 
-	// associate the egl-context with the egl-surface
-	eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context);
-	eglSwapInterval(egl_display, 0);
+	src_stride = align_up(width * 4 + stride_pad, stride_align);
+	frame_bytes = src_stride * height;
+	if (source_format == FORMAT_NV12)
+		frame_bytes = width * height * 3 / 2;
 
+	if (source_format == FORMAT_NV12 && src_stride != width * 4) {
+		printf("padded strides are only supported for rgba sources\n");
+		exit(1);
+	}
 
-	///////  the openGL part  /////////////////////////////////////
+	if (upload_strategy && source_format != FORMAT_RGBA) {
+		printf("--upload-path applies to rgba sources\n");
+		exit(1);
+	}
+	if (autotune && (source_format != FORMAT_RGBA || source_file || num_producers ||
+			 renderer != RENDERER_GL || present != PRESENT_GL ||
+			 num_surfaces > 1 || surface_threads || num_processes > 1)) {
+		printf("--autotune searches the upload paths for rgba source frames on one GL surface\n");
+		exit(1);
+	}
+	if (verify && (source_format != FORMAT_RGBA || num_producers ||
+		       shader != &shader_variants[0] || renderer != RENDERER_GL || present != PRESENT_GL ||
+		       num_surfaces > 1 || surface_threads || num_processes > 1)) {
+		printf("--verify checks the rgba upload paths on one GL surface\n");
+		exit(1);
+	}
+	if ((shader_all || shader != &shader_variants[0]) &&
+	    (source_format != FORMAT_RGBA || renderer != RENDERER_GL)) {
+		printf("--shader applies to rgba sources drawn with GL\n");
+		exit(1);
+	}
+	if (shader_all && (!fillrate || num_surfaces > 1 || surface_threads || num_processes > 1 ||
+			   present != PRESENT_GL)) {
+		printf("--shader all measures the fill rate of each variant on one GL surface\n");
+		exit(1);
+	}
+	if (startup && (renderer != RENDERER_GL || present != PRESENT_GL || autotune || verify ||
+			map_probe || shader_all)) {
+		printf("--startup traces the GL path to the first eglSwapBuffers\n");
+		exit(1);
+	}
+	if (program_cache && mkdir(program_cache, 0755) < 0 && errno != EEXIST) {
+		perror(program_cache);
+		exit(1);
+	}
+	if (map_probe && (renderer != RENDERER_GL || present != PRESENT_GL ||
+			  num_surfaces > 1 || surface_threads || num_processes > 1)) {
+		printf("--map-probe runs on one GL surface\n");
+		exit(1);
+	}
+	if (upload_profile && source_format != FORMAT_RGBA) {
+		printf("--upload-profile applies to rgba sources\n");
+		exit(1);
+	}
+	if (pbo_depth && upload_strategy != &cpl_upload_pbo) {
+		printf("--pbo-depth needs --upload-path pbo\n");
+		exit(1);
+	}
+	if ((copy_kernel || copy_kernel_all) && upload_strategy != &cpl_upload_pbo &&
+	    upload_strategy != &cpl_upload_repack) {
+		printf("--copy-kernel needs --upload-path pbo or repack\n");
+		exit(1);
+	}
 
-	// load vertex shader
-	GLuint vertexShader = load_shader(vertex_src, GL_VERTEX_SHADER);
-	// load fragment shader
-	GLuint fragmentShader = load_shader(fragment_src, GL_FRAGMENT_SHADER);
+	if (source_format == FORMAT_NV12 && !source_file) {
+		printf("--source-format nv12 needs a --source-file\n");
+		exit(1);
+	}
+	if (source_file && (source_pool_bytes || source_alloc != ALLOC_STATIC || numa_node >= 0)) {
+		printf("--source-file cannot be combined with a source pool\n");
+		exit(1);
+	}
+	if (num_producers && !upload) {
+		printf("--producers feeds --upload, nothing consumes its frames otherwise\n");
+		exit(1);
+	}
+	if (num_producers && (source_file || source_pool_bytes)) {
+		printf("--producers generates its own frames, it cannot be combined with --source-file or a source pool\n");
+		exit(1);
+	}
+	if (renderer == RENDERER_CPU && (!fillrate || source_format != FORMAT_RGBA)) {
+		printf("--renderer cpu measures fill rate of rgba sources, use it with --fillrate\n");
+		exit(1);
+	}
+	if ((dirty_rects || dirty_script) && (!upload || source_format != FORMAT_RGBA ||
+					       present != PRESENT_GL)) {
+		printf("dirty rects are a variant of --upload with rgba sources\n");
+		exit(1);
+	}
+	if ((damage_fraction > 0. || pacing) && (renderer != RENDERER_GL || present != PRESENT_GL)) {
+		printf("--damage and --swap-interval apply to EGL presentation only\n");
+		exit(1);
+	}
+	if (gpu_timing && (renderer != RENDERER_GL || present != PRESENT_GL)) {
+		printf("--gpu-timing times the GL upload and draw, it cannot be combined with --renderer cpu or --present xshm\n");
+		exit(1);
+	}
+	if (readback != READBACK_NONE && (renderer != RENDERER_GL || present != PRESENT_GL)) {
+		printf("--readback reads back the GL rendering, it cannot be combined with --renderer cpu or --present xshm\n");
+		exit(1);
+	}
+	if (present == PRESENT_XSHM && (source_format != FORMAT_RGBA ||
+					(fillrate && renderer != RENDERER_CPU))) {
+		printf("--present xshm shows rgba frames from --upload or --renderer cpu\n");
+		exit(1);
+	}
 
-	// create program object
-	GLuint shaderProgram  = glCreateProgram();
-	// and attach both...
-	glAttachShader(shaderProgram, vertexShader);
-	// ... shaders to it
-	glAttachShader(shaderProgram, fragmentShader);
+	if ((num_surfaces > 1 || surface_threads) &&
+	    (readback != READBACK_NONE || dirty_rects || dirty_script || damage_fraction > 0. ||
+	     pacing || gpu_timing || num_producers || source_file ||
+	     renderer != RENDERER_GL || present != PRESENT_GL)) {
+		printf("--surfaces and --surface-threads measure plain --fillrate or --upload with GL presentation\n");
+		exit(1);
+	}
+	if (surface_threads && (render_cpu >= 0 || sched_fifo_prio)) {
+		printf("--render-cpu and --sched-fifo apply to a single render thread, not --surface-threads\n");
+		exit(1);
+	}
+	if (surface_pbuffer && (damage_fraction > 0. || pacing || present != PRESENT_GL ||
+				renderer != RENDERER_GL)) {
+		printf("pbuffer surfaces are never presented, they cannot be combined with --damage, --swap-interval or other presenters\n");
+		exit(1);
+	}
 
-	glLinkProgram(shaderProgram);    // link the program
-	glUseProgram(shaderProgram);    // and select it for usage
+	detect_caches();
 
 	// prepare the textures
 	if (width == 512 && height == 512) {
-		textures[0] = gimp_image_512_1.pixel_data;
-		textures[1] = gimp_image_512_2.pixel_data;
-		textures[2] = gimp_image_512_3.pixel_data;
-		textures[3] = gimp_image_512_4.pixel_data;
+		images[0] = gimp_image_512_1.pixel_data;
+		images[1] = gimp_image_512_2.pixel_data;
+		images[2] = gimp_image_512_3.pixel_data;
+		images[3] = gimp_image_512_4.pixel_data;
 	} else if (width == 256 && height == 256) {
-		textures[0] = gimp_image_256_1.pixel_data;
-		textures[1] = gimp_image_256_2.pixel_data;
-		textures[2] = gimp_image_256_3.pixel_data;
-		textures[3] = gimp_image_256_4.pixel_data;
-	} else {
+		images[0] = gimp_image_256_1.pixel_data;
+		images[1] = gimp_image_256_2.pixel_data;
+		images[2] = gimp_image_256_3.pixel_data;
+		images[3] = gimp_image_256_4.pixel_data;
+	} else if (!source_file) {
 		printf("unknown width/height (%d/%d)\n", width, height);
 		exit(1);
 	}
 
-	// upload the texture
-	texture_id = upload_texture();
+	// the static images are tightly packed, padded rows need copies even
+	// with producers, for the first upload and the calibration
+	if (source_file)
+		setup_source_file();
+	else if (source_pool_bytes || source_alloc != ALLOC_STATIC || numa_node >= 0 ||
+		 src_stride != width * 4)
+		setup_source_pool();
+
+	surfaces = calloc(num_surfaces, sizeof(*surfaces));
+	if (surfaces == NULL) {
+		fprintf(stderr, "unable to allocate surfaces\n");
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGALRM, on_signal);
+
+	if (energy)
+		setup_energy();
+	if (calibrate)
+		run_calibration();
+
+	// fork before anything talks to X or EGL, each worker opens its own
+	// connection and runs the benchmark below
+	if (num_processes > 1 && fork_workers() < 0)
+		return wait_workers();
+
+	if (renderer == RENDERER_CPU && present == PRESENT_GL)
+		return run_cpu_renderer();
+
+	// the surface threads swap while the main thread polls for events
+	if (surface_threads)
+		XInitThreads();
+
+	// open the standard display (the primary screen), pbuffers do
+	// without one if there is no X server
+	step_start = now();
+	x_display = XOpenDisplay(NULL);
+	startup_mark("XOpenDisplay", step_start);
+	if (x_display == NULL && !surface_pbuffer) {
+		fprintf(stderr, "cannot connect to X server\n");
+		return 1;
+	}
+
+	if (present == PRESENT_XSHM)
+		return run_xshm_present(create_window(0, basename(argv[0])));
+
+	step_start = now();
+	egl_display = eglGetDisplay(x_display ? (EGLNativeDisplayType) x_display :
+				    EGL_DEFAULT_DISPLAY);
+	if (egl_display == EGL_NO_DISPLAY) {
+		fprintf(stderr, "Got no EGL display.\n");
+		return 1;
+	}
+	startup_mark("eglGetDisplay", step_start);
 
-	// now get the locations of the shaders variables
-	position_loc = glGetAttribLocation(shaderProgram, "a_position");
-	if (position_loc < 0) {
-		fprintf(stderr, "Unable to get position location\n");
+	step_start = now();
+	if (!eglInitialize(egl_display, NULL, NULL)) {
+		fprintf(stderr, "Unable to initialize EGL\n");
 		return 1;
 	}
-	texture_loc = glGetAttribLocation(shaderProgram, "a_texCoord");
-	if (texture_loc < 0) {
-		fprintf(stderr, "Unable to get texture location\n");
+	startup_mark("eglInitialize", step_start);
+
+	EGLint attr[] = {       // some attributes to set up our egl-interface
+		EGL_BUFFER_SIZE, 32,
+		EGL_RENDERABLE_TYPE,
+		EGL_OPENGL_ES2_BIT,
+		EGL_SURFACE_TYPE,
+		surface_pbuffer ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
+		EGL_NONE
+	};
+
+	EGLint num_config;
+	step_start = now();
+	if (!eglChooseConfig(egl_display, attr, &egl_config, 1, &num_config)) {
+		fprintf(stderr, "Failed to choose config (eglError: %d)\n",
+			eglGetError());
 		return 1;
 	}
 
-	// Get the sampler location
-	sampler_loc = glGetUniformLocation(shaderProgram, "s_texture");
-	if (sampler_loc < 0) {
-		fprintf(stderr, "Unable to get sampler location\n");
+	if (num_config != 1) {
+		fprintf(stderr, "Didn't get exactly one config, but %d\n",
+			num_config);
 		return 1;
 	}
+	startup_mark("eglChooseConfig", step_start);
+
+	for (c = 0; c < num_surfaces; c++)
+		setup_surface(&surfaces[c], c, basename(argv[0]));
+	if (num_surfaces > 1)
+		eglMakeCurrent(egl_display, surfaces[0].egl_surface, surfaces[0].egl_surface,
+			       surfaces[0].egl_context);
+
+	if (autotune)
+		return run_autotune();
+	if (verify)
+		return run_verify(&surfaces[0]);
+	if (map_probe)
+		return run_map_probe();
+	if (shader_all)
+		return run_shader_matrix(&surfaces[0]);
+
+	if (readback != READBACK_NONE)
+		setup_readback();
+	if (dirty_rects || dirty_script)
+		setup_dirty();
+	if (damage_fraction > 0.)
+		setup_damage();
+	if (pacing)
+		setup_pacing();
+	if (gpu_timing)
+		setup_gpu_timing();
+
+	// pin only now, so threads the driver spawned during setup keep
+	// their own affinity
+	begin_run();
+	if (surface_threads)
+		start_surface_threads();
 
 	// this is needed for time measuring  -->  frames per second
 	struct timezone tz;
 	struct timeval t1, t2;
 	gettimeofday(&t1, &tz);
 	int num_frames = 0;
+	double report_start = now();
 
 	// main draw loop
 	bool quit = false;
-	while (!quit) {
+	while (!quit && !interrupted) {
 
 		// check for events from the x-server
-		while (XPending(x_display)) {
+		while (x_display && XPending(x_display)) {
 			XEvent  xev;
 			XNextEvent(x_display, &xev);
 
@@ -479,32 +4679,120 @@ int main(int argc, char **argv)
 				quit = true;
 		}
 
-		render();   // now we finally put something on the screen
+		if (surface_threads) {
+			usleep(10000);
+		} else {
+			for (c = 0; c < num_surfaces; c++) {
+				struct surface *surf = &surfaces[c];
+
+				if (num_surfaces > 1)
+					eglMakeCurrent(egl_display, surf->egl_surface,
+						       surf->egl_surface, surf->egl_context);
+				render(surf);   // now we finally put something on the screen
+			}
+		}
+
+		if (num_surfaces > 1 || surface_threads) {
+			if (now() - report_start >= SURFACE_REPORT_INTERVAL) {
+				report_surfaces(now() - report_start);
+				report_start = now();
+			}
+			continue;
+		}
 
 		if (++num_frames % 1000 == 0) {
 			gettimeofday(&t2, &tz);
 			float dt = t2.tv_sec - t1.tv_sec + (t2.tv_usec - t1.tv_usec) * 1e-6;
 			printf("fps: %f\n", num_frames / dt);
 			if (fillrate) {
-				printf("fill rate: %f MiB/s\n", (num_frames * width * height * 4)/ (dt * 1024. * 1024.));
+				printf("fill rate: %f MiB/s", (num_frames * width * height * 4)/ (dt * 1024. * 1024.));
+				if (shader != &shader_variants[0])
+					printf(" [shader %s]", shader->name);
+				printf("\n");
 			}
 			if (upload) {
-				printf("texture upload rate: %f MiB/s\n", (upload_size) / (upload_dt * 1024. * 1024.));
+				printf("texture upload rate: %f MiB/s", (surfaces[0].upload_size) /
+				       (surfaces[0].upload_dt * 1024. * 1024.));
+				if (source_map)
+					printf(" (%f MiB/s including page faults, %ld major / %ld minor faults)",
+					       (surfaces[0].upload_size) /
+					       ((surfaces[0].upload_dt + fault_dt) * 1024. * 1024.),
+					       major_faults, minor_faults);
+				else if (textures != images)
+					printf(" (source %s)", source_alloc_names[source_alloc]);
+				if (src_stride != width * 4 || unpack_alignment != 1 ||
+				    upload_strategy != &cpl_upload_teximage)
+					printf(" [stride %d, alignment %d, %s%s%s]", src_stride,
+					       unpack_alignment, upload_strategy->name,
+					       copy_kernel ? ", " : "",
+					       copy_kernel ? copy_kernel->name : "");
+				if (memcpy_ceiling > 0.)
+					printf(", %.0f%% of memcpy", 100. * surfaces[0].upload_size /
+					       (surfaces[0].upload_dt * 1024. * 1024.) / memcpy_ceiling);
+				printf("\n");
+				if (dirty_rects || dirty_script)
+					report_dirty();
+			}
+			if (readback != READBACK_NONE && latency_count) {
+				printf("readback rate: %f MiB/s, latency %f ms (min %f, max %f)\n",
+				       readback_size / (readback_dt * 1024. * 1024.),
+				       latency_sum * 1e3 / latency_count,
+				       latency_min * 1e3, latency_max * 1e3);
+				readback_dt = 0.;
+				readback_size = 0;
+				latency_sum = 0.;
+				latency_count = 0;
+			}
+			if (num_producers) {
+				unsigned long long bytes = 0;
+				int n;
+				for (n = 0; n < num_producers; n++)
+					bytes += atomic_exchange(&producers[n].bytes, 0);
+				printf("producer write rate: %f MiB/s, render stalls: %u (%f ms)\n",
+				       bytes / (dt * 1024. * 1024.), stalls, stall_dt * 1e3);
+				stalls = 0;
+				stall_dt = 0.;
 			}
+			if (damage_fraction > 0.) {
+				printf("present: %s, %f ms/swap", damage_full_phase ?
+				       "full swap" : damage_method, swap_dt * 1e3 / swaps);
+				if (!damage_full_phase && set_damage_region)
+					printf(", buffer age %.1f", (float)buffer_age_sum / swaps);
+				printf("\n");
+				damage_full_phase = !damage_full_phase;
+				buffer_age_sum = 0;
+			}
+			swap_dt = 0.;
+			swaps = 0;
+			if (pacing)
+				report_pacing();
+			if (gpu_timing)
+				report_gpu_timing(surfaces[0].upload_dt, num_frames);
+			report_energy(num_frames, dt, upload ? surfaces[0].upload_size : 0.,
+				      fillrate ? num_frames * width * height * 4. : 0.);
+			check_cpufreq();
 			num_frames = 0;
-			upload_dt = 0.;
-			upload_size = 0;
+			surfaces[0].upload_dt = 0.;
+			surfaces[0].upload_size = 0;
+			fault_dt = 0.;
+			minor_faults = 0;
+			major_faults = 0;
 			t1 = t2;
 		}
 	}
 
 
 	//  cleaning up...
-	eglDestroyContext(egl_display, egl_context);
-	eglDestroySurface(egl_display, egl_surface);
+	if (surface_threads)
+		stop_surface_threads();
+	end_run();
+
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	for (c = 0; c < num_surfaces; c++)
+		destroy_surface(&surfaces[c]);
 	eglTerminate(egl_display);
-	XDestroyWindow(x_display, win);
-	XCloseDisplay(x_display);
+	if (x_display)
+		XCloseDisplay(x_display);
 
 	return 0;
 }
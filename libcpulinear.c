@@ -0,0 +1,1099 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <EGL/egl.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <GLES2/gl2.h>
+#include <GLES3/gl3.h>
+
+#include "libcpulinear.h"
+
+#define PBO_DEPTH 3
+
+// how far ahead of the copy the prefetching kernels load
+#define PREFETCH_DISTANCE 512
+
+const char cpl_vertex_src[] =
+	"attribute vec4 a_position;   \n"
+	"attribute vec2 a_texCoord;   \n"
+	"varying vec2 v_texCoord;     \n"
+	"void main()                  \n"
+	"{                            \n"
+	"   gl_Position = a_position; \n"
+	"   v_texCoord = a_texCoord;  \n"
+	"}                            \n";
+
+const char cpl_fragment_src[] =
+	"precision mediump float;                            \n"
+	"varying vec2 v_texCoord;                            \n"
+	"uniform sampler2D s_texture;                        \n"
+	"void main()                                         \n"
+	"{                                                   \n"
+	"  gl_FragColor = texture2D(s_texture, v_texCoord);  \n"
+	"}                                                   \n";
+
+static const GLfloat quad_vertices[] = {
+	-1.0, -1.0,  0.0, // bottom left
+	 0.0,  1.0,
+	-1.0,  1.0,  0.0, // top left
+	 0.0,  0.0,
+	 1.0,  1.0,  0.0, // top right
+	 1.0,  0.0,
+	 1.0, -1.0,  0.0, // bottom right
+	 1.0,  1.0,
+	-1.0, -1.0,  0.0,
+	 0.0,  1.0
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int align_up(int n, int a)
+{
+	return (n + a - 1) / a * a;
+}
+
+static bool always_copy(void)
+{
+	return true;
+}
+
+static void copy_memcpy(void *dst, const void *src, size_t len)
+{
+	memcpy(dst, src, len);
+}
+
+// memcpy in cache line steps, touching the source well ahead
+static void copy_prefetch(void *dst, const void *src, size_t len)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		__builtin_prefetch(s + PREFETCH_DISTANCE, 0, 0);
+		memcpy(d, s, 64);
+	}
+	memcpy(d, s, len);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// fast on CPUs with ERMSB, and what many libcs use for large copies
+static void copy_rep_movsb(void *dst, const void *src, size_t len)
+{
+	__asm__ volatile("rep movsb" : "+D" (dst), "+S" (src), "+c" (len) : : "memory");
+}
+#endif
+
+#if defined(__SSE2__)
+// streaming stores bypass the cache and fill whole write-combining
+// buffers, the stores need 16 byte alignment
+static inline void copy_sse2_stream(void *dst, const void *src, size_t len, bool prefetch)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+	size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+	if (head > len)
+		head = len;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		__m128i a, b, c, e;
+
+		if (prefetch)
+			_mm_prefetch((const char *)s + PREFETCH_DISTANCE, _MM_HINT_NTA);
+		a = _mm_loadu_si128((const __m128i *)s);
+		b = _mm_loadu_si128((const __m128i *)(s + 16));
+		c = _mm_loadu_si128((const __m128i *)(s + 32));
+		e = _mm_loadu_si128((const __m128i *)(s + 48));
+		_mm_stream_si128((__m128i *)d, a);
+		_mm_stream_si128((__m128i *)(d + 16), b);
+		_mm_stream_si128((__m128i *)(d + 32), c);
+		_mm_stream_si128((__m128i *)(d + 48), e);
+	}
+	_mm_sfence();
+	memcpy(d, s, len);
+}
+
+static void copy_sse2_nt(void *dst, const void *src, size_t len)
+{
+	copy_sse2_stream(dst, src, len, false);
+}
+
+static void copy_sse2_nt_prefetch(void *dst, const void *src, size_t len)
+{
+	copy_sse2_stream(dst, src, len, true);
+}
+
+static bool has_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2_nt(void *dst, const void *src, size_t len)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+	size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+
+	if (head > len)
+		head = len;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)s);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+		_mm256_stream_si256((__m256i *)d, a);
+		_mm256_stream_si256((__m256i *)(d + 32), b);
+	}
+	_mm_sfence();
+	memcpy(d, s, len);
+}
+#endif
+
+#if defined(__aarch64__)
+static void copy_neon(void *dst, const void *src, size_t len)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64)
+		__asm__ volatile("ldp q0, q1, [%1]\n\t"
+				 "ldp q2, q3, [%1, #32]\n\t"
+				 "stp q0, q1, [%0]\n\t"
+				 "stp q2, q3, [%0, #32]"
+				 : : "r" (d), "r" (s) : "v0", "v1", "v2", "v3", "memory");
+	memcpy(d, s, len);
+}
+
+// stnp hints that the lines will not be read again soon
+static void copy_neon_nt(void *dst, const void *src, size_t len)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64)
+		__asm__ volatile("ldp q0, q1, [%1]\n\t"
+				 "ldp q2, q3, [%1, #32]\n\t"
+				 "stnp q0, q1, [%0]\n\t"
+				 "stnp q2, q3, [%0, #32]"
+				 : : "r" (d), "r" (s) : "v0", "v1", "v2", "v3", "memory");
+	memcpy(d, s, len);
+}
+#endif
+
+const struct cpl_copy_kernel cpl_copy_kernels[] = {
+	{ "memcpy", always_copy, copy_memcpy },
+	{ "prefetch", always_copy, copy_prefetch },
+#if defined(__x86_64__) || defined(__i386__)
+	{ "rep-movsb", always_copy, copy_rep_movsb },
+#endif
+#if defined(__SSE2__)
+	{ "sse2-nt", always_copy, copy_sse2_nt },
+	{ "sse2-nt-prefetch", always_copy, copy_sse2_nt_prefetch },
+	{ "avx2-nt", has_avx2, copy_avx2_nt },
+#endif
+#if defined(__aarch64__)
+	{ "neon", always_copy, copy_neon },
+	{ "neon-nt", always_copy, copy_neon_nt },
+#endif
+	{ NULL, NULL, NULL }
+};
+
+const struct cpl_copy_kernel *cpl_find_copy_kernel(const char *name)
+{
+	int k;
+
+	for (k = 0; cpl_copy_kernels[k].name; k++)
+		if (strcmp(cpl_copy_kernels[k].name, name) == 0)
+			return &cpl_copy_kernels[k];
+	return NULL;
+}
+
+double cpl_copy_rate(const struct cpl_copy_kernel *k, const GLubyte *src, size_t bytes,
+		     bool mapped, double seconds)
+{
+	GLuint pbo = 0;
+	void *dst;
+	double start, t, copied = 0.;
+
+	if (mapped) {
+		glGenBuffers(1, &pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+				       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	} else if (posix_memalign(&dst, 64, bytes) != 0)
+		dst = NULL;
+	if (dst == NULL) {
+		if (mapped) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glDeleteBuffers(1, &pbo);
+		}
+		return 0.;
+	}
+
+	start = now();
+	do {
+		k->copy(dst, src, bytes);
+		copied += bytes;
+		t = now();
+	} while (t - start < seconds);
+
+	if (mapped) {
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &pbo);
+	} else
+		free(dst);
+
+	return copied / ((t - start) * 1024. * 1024.);
+}
+
+int cpl_gles_version(void)
+{
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major;
+
+	if (version == NULL || sscanf(version, "OpenGL ES %d", &major) != 1)
+		return 2;
+	return major;
+}
+
+// the stride GL derives from the width and GL_UNPACK_ALIGNMENT
+static bool implied_stride(const struct cpl_upload *u)
+{
+	return u->stride == align_up(u->width * 4, u->alignment);
+}
+
+static bool row_length_stride(const struct cpl_upload *u)
+{
+	return u->gles_version >= 3 && u->stride % u->alignment == 0;
+}
+
+static bool always(const struct cpl_upload *u)
+{
+	(void)u;
+	return true;
+}
+
+static bool texsubimage_supported(const struct cpl_upload *u)
+{
+	return implied_stride(u) || row_length_stride(u);
+}
+
+// GL_UNPACK_ROW_LENGTH is only there from GLES3 on, and 0 means "width"
+static void set_row_length(const struct cpl_upload *u, int pixels)
+{
+	if (u->gles_version >= 3)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, pixels);
+}
+
+static int no_init(struct cpl_upload *u)
+{
+	(void)u;
+	return 0;
+}
+
+static void no_fini(struct cpl_upload *u)
+{
+	(void)u;
+}
+
+static void teximage_upload(struct cpl_upload *u, const GLubyte *data)
+{
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, u->width, u->height, 0, GL_RGBA,
+		     GL_UNSIGNED_BYTE, data);
+}
+
+static int row_length_init(struct cpl_upload *u)
+{
+	set_row_length(u, u->stride / 4);
+	return 0;
+}
+
+// bytes between the rows repack and pbo write themselves, as short as
+// the requested unpack alignment allows
+static int packed_pitch(const struct cpl_upload *u)
+{
+	return align_up(u->width * 4, u->alignment);
+}
+
+static int repack_init(struct cpl_upload *u)
+{
+	u->repack_buf = malloc(packed_pitch(u) * u->height);
+	if (u->repack_buf == NULL) {
+		fprintf(stderr, "unable to allocate repack buffer\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void repack_upload(struct cpl_upload *u, const GLubyte *data)
+{
+	int pitch = packed_pitch(u), y;
+
+	for (y = 0; y < u->height; y++)
+		u->copy->copy(u->repack_buf + y * pitch, data + y * u->stride, u->width * 4);
+	teximage_upload(u, u->repack_buf);
+}
+
+static void repack_fini(struct cpl_upload *u)
+{
+	free(u->repack_buf);
+	u->repack_buf = NULL;
+}
+
+static int texsubimage_init(struct cpl_upload *u)
+{
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, u->width, u->height, 0, GL_RGBA,
+		     GL_UNSIGNED_BYTE, NULL);
+	if (!implied_stride(u))
+		set_row_length(u, u->stride / 4);
+	return 0;
+}
+
+static void texsubimage_upload(struct cpl_upload *u, const GLubyte *data)
+{
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, u->width, u->height, GL_RGBA,
+			GL_UNSIGNED_BYTE, data);
+}
+
+static bool pbo_supported(const struct cpl_upload *u)
+{
+	return u->gles_version >= 3;
+}
+
+// the buffers hold packed frames, a ring of them lets the driver keep
+// reading one while the next is written
+static int pbo_init(struct cpl_upload *u)
+{
+	int k;
+
+	if (u->pbo_depth < 1)
+		u->pbo_depth = PBO_DEPTH;
+	u->pbos = calloc(u->pbo_depth, sizeof(*u->pbos));
+	if (u->pbos == NULL) {
+		fprintf(stderr, "unable to allocate pixel buffers\n");
+		return -1;
+	}
+
+	glGenBuffers(u->pbo_depth, u->pbos);
+	for (k = 0; k < u->pbo_depth; k++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbos[k]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, packed_pitch(u) * u->height, NULL,
+			     GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, u->width, u->height, 0, GL_RGBA,
+		     GL_UNSIGNED_BYTE, NULL);
+	u->pbo_next = 0;
+	return 0;
+}
+
+static void pbo_upload(struct cpl_upload *u, const GLubyte *data)
+{
+	GLubyte *dst;
+	int pitch = packed_pitch(u), y;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->pbos[u->pbo_next]);
+	u->pbo_next = (u->pbo_next + 1) % u->pbo_depth;
+
+	dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, pitch * u->height,
+			       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (dst == NULL) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+	if (u->stride == pitch)
+		u->copy->copy(dst, data, pitch * u->height);
+	else
+		for (y = 0; y < u->height; y++)
+			u->copy->copy(dst + y * pitch, data + y * u->stride, u->width * 4);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// packed rows again, whatever the source looked like
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, u->alignment);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, u->width, u->height, GL_RGBA,
+			GL_UNSIGNED_BYTE, 0);
+
+	// client pointers mean client memory again for everyone else
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void pbo_fini(struct cpl_upload *u)
+{
+	glDeleteBuffers(u->pbo_depth, u->pbos);
+	free(u->pbos);
+	u->pbos = NULL;
+}
+
+const struct cpl_upload_strategy cpl_upload_teximage = {
+	"teximage", implied_stride, no_init, teximage_upload, no_fini
+};
+
+const struct cpl_upload_strategy cpl_upload_row_length = {
+	"row-length", row_length_stride, row_length_init, teximage_upload, no_fini
+};
+
+const struct cpl_upload_strategy cpl_upload_repack = {
+	"repack", always, repack_init, repack_upload, repack_fini
+};
+
+const struct cpl_upload_strategy cpl_upload_texsubimage = {
+	"texsubimage", texsubimage_supported, texsubimage_init, texsubimage_upload, no_fini
+};
+
+const struct cpl_upload_strategy cpl_upload_pbo = {
+	"pbo", pbo_supported, pbo_init, pbo_upload, pbo_fini
+};
+
+const struct cpl_upload_strategy *const cpl_upload_strategies[] = {
+	&cpl_upload_teximage,
+	&cpl_upload_row_length,
+	&cpl_upload_repack,
+	&cpl_upload_texsubimage,
+	&cpl_upload_pbo,
+	NULL
+};
+
+const struct cpl_upload_strategy *cpl_find_upload_strategy(const char *name)
+{
+	int k;
+
+	for (k = 0; cpl_upload_strategies[k]; k++)
+		if (strcmp(cpl_upload_strategies[k]->name, name) == 0)
+			return cpl_upload_strategies[k];
+	return NULL;
+}
+
+int cpl_upload_configs(int width, int height, int stride,
+		       struct cpl_upload_config *c, int max)
+{
+	static const int alignments[] = { 1, 2, 4, 8 };
+	static const int depths[] = { 1, 2, 3, 4 };
+	int gles_version = cpl_gles_version();
+	int n = 0, k, j, d, m;
+
+	for (k = 0; cpl_upload_strategies[k]; k++) {
+		const struct cpl_upload_strategy *s = cpl_upload_strategies[k];
+		// these pack rows of their own, at 4 they are as tight as at 1 or 2
+		bool own_rows = s == &cpl_upload_repack || s == &cpl_upload_pbo;
+
+		for (j = 0; j < 4; j++) {
+			struct cpl_upload probe = {
+				.strategy = s, .width = width, .height = height, .stride = stride,
+				.alignment = alignments[j], .gles_version = gles_version
+			};
+
+			if ((own_rows && alignments[j] != 4) || !s->supported(&probe))
+				continue;
+			// tight rows are the same upload at every alignment
+			if (s == &cpl_upload_teximage && stride == width * 4 && alignments[j] != 1)
+				continue;
+			for (d = 0; d < (s == &cpl_upload_pbo ? 4 : 1); d++)
+				for (m = 0; cpl_copy_kernels[m].name; m++) {
+					const struct cpl_copy_kernel *copy = &cpl_copy_kernels[m];
+
+					if (!copy->supported() || (!own_rows && m > 0))
+						continue;
+					if (n == max)
+						return n;
+					c[n].strategy = s;
+					c[n].alignment = alignments[j];
+					c[n].pbo_depth = s == &cpl_upload_pbo ? depths[d] : 0;
+					c[n].copy = own_rows ? copy : NULL;
+					n++;
+				}
+		}
+	}
+	return n;
+}
+
+int cpl_upload_init(struct cpl_upload *u, const struct cpl_upload_strategy *strategy,
+		    int width, int height, int stride, int alignment, int pbo_depth)
+{
+	memset(u, 0, sizeof(*u));
+	u->strategy = strategy;
+	u->width = width;
+	u->height = height;
+	u->stride = stride;
+	u->alignment = alignment;
+	u->gles_version = cpl_gles_version();
+	u->pbo_depth = pbo_depth;
+	u->copy = &cpl_copy_kernels[0];
+
+	if (!strategy->supported(u)) {
+		fprintf(stderr, "upload path %s cannot take %d byte rows at alignment %d on GLES %d\n",
+			strategy->name, stride, alignment, u->gles_version);
+		return -1;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	set_row_length(u, 0);
+
+	glGenTextures(1, &u->texture);
+	glBindTexture(GL_TEXTURE_2D, u->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	// GLES2 needs it for non power of two sizes, and linear filtering
+	// must not blend in the opposite edge
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	if (strategy->init(u) < 0) {
+		glDeleteTextures(1, &u->texture);
+		u->texture = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void cpl_upload_frame(struct cpl_upload *u, const GLubyte *data)
+{
+	glBindTexture(GL_TEXTURE_2D, u->texture);
+	u->strategy->upload(u, data);
+}
+
+void cpl_upload_fini(struct cpl_upload *u)
+{
+	u->strategy->fini(u);
+	glDeleteTextures(1, &u->texture);
+	u->texture = 0;
+}
+
+static void print_shader_info_log(GLuint shader)
+{
+	GLint length;
+
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+
+	if (length > 1) {
+		char *buffer = (char *)malloc(length);
+		glGetShaderInfoLog(shader, length, NULL, buffer);
+		printf("%s\n", buffer);
+		free(buffer);
+	}
+}
+
+GLuint cpl_load_shader(const char *source, GLenum type)
+{
+	GLuint shader = glCreateShader(type);
+	GLint success;
+
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+
+	print_shader_info_log(shader);
+
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (success != GL_TRUE) {
+		fprintf(stderr, "Error compiling shader\n");
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// links the program from source, asking for a binary that can be saved
+static int link_program(struct cpl_quad *q, const char *fragment_src, bool retrievable)
+{
+	GLuint vertex_shader, fragment_shader;
+	GLint linked;
+
+	vertex_shader = cpl_load_shader(cpl_vertex_src, GL_VERTEX_SHADER);
+	fragment_shader = cpl_load_shader(fragment_src, GL_FRAGMENT_SHADER);
+	if (!vertex_shader || !fragment_shader)
+		return -1;
+
+	q->program = glCreateProgram();
+	glAttachShader(q->program, vertex_shader);
+	glAttachShader(q->program, fragment_shader);
+	if (retrievable && cpl_gles_version() >= 3)
+		glProgramParameteri(q->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(q->program);
+	// the program keeps them alive as long as it needs them
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+
+	glGetProgramiv(q->program, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE) {
+		fprintf(stderr, "Unable to link the program\n");
+		return -1;
+	}
+	return 0;
+}
+
+// glGetProgramBinary and glProgramBinary of GLES3 or OES_get_program_binary,
+// the signatures are the same
+typedef void (*get_binary_fn)(GLuint, GLsizei, GLsizei *, GLenum *, void *);
+typedef void (*program_binary_fn)(GLuint, GLenum, const void *, GLsizei);
+
+static bool program_binary_funcs(get_binary_fn *get, program_binary_fn *load)
+{
+	const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+	GLint formats = 0;
+
+	if (cpl_gles_version() >= 3) {
+		*get = glGetProgramBinary;
+		*load = glProgramBinary;
+	} else if (ext && strstr(ext, "GL_OES_get_program_binary")) {
+		*get = (get_binary_fn)eglGetProcAddress("glGetProgramBinaryOES");
+		*load = (program_binary_fn)eglGetProcAddress("glProgramBinaryOES");
+	} else
+		return false;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return *get && *load && formats > 0;
+}
+
+static unsigned long long fnv1a(unsigned long long h, const char *s)
+{
+	// the terminating NUL goes in too, so "ab" "c" differs from "a" "bc"
+	do {
+		h ^= (unsigned char)*s;
+		h *= 0x100000001b3ULL;
+	} while (*s++);
+	return h;
+}
+
+#define FNV_BASIS 0xcbf29ce484222325ULL
+
+// <dir>/<driver hash>-<source hash>.bin, a binary is only good for the
+// driver build that made it
+static void cache_path(char *path, size_t size, const char *cache_dir, const char *fragment_src)
+{
+	static const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	unsigned long long driver = FNV_BASIS, source;
+	int k;
+
+	for (k = 0; k < 3; k++) {
+		const char *s = (const char *)glGetString(strings[k]);
+		driver = fnv1a(driver, s ? s : "");
+	}
+	source = fnv1a(fnv1a(FNV_BASIS, cpl_vertex_src), fragment_src);
+	snprintf(path, size, "%s/%016llx-%016llx.bin", cache_dir, driver, source);
+}
+
+struct binary_header {
+	char magic[4];
+	GLenum format;
+	GLsizei length;
+};
+
+static bool load_program_binary(struct cpl_quad *q, const char *path)
+{
+	struct binary_header h;
+	get_binary_fn get;
+	program_binary_fn load;
+	void *binary = NULL;
+	GLint linked = GL_FALSE;
+	FILE *f;
+
+	if (!program_binary_funcs(&get, &load) || (f = fopen(path, "rb")) == NULL)
+		return false;
+	if (fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, "CPLB", 4) == 0 &&
+	    h.length > 0 && (binary = malloc(h.length)) &&
+	    fread(binary, h.length, 1, f) == 1) {
+		q->program = glCreateProgram();
+		load(q->program, h.format, binary, h.length);
+		// a driver update may refuse binaries of the old one
+		glGetProgramiv(q->program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE) {
+			glDeleteProgram(q->program);
+			q->program = 0;
+		}
+	}
+	free(binary);
+	fclose(f);
+	// a failed glProgramBinary leaves an error behind
+	while (glGetError() != GL_NO_ERROR)
+		;
+	return linked == GL_TRUE;
+}
+
+// written to a temporary file and renamed, so concurrent processes never
+// read half a binary
+static enum cpl_program_source save_program_binary(const struct cpl_quad *q, const char *path)
+{
+	struct binary_header h = { .magic = { 'C', 'P', 'L', 'B' } };
+	get_binary_fn get;
+	program_binary_fn load;
+	char tmp[512];
+	void *binary;
+	GLint length = 0;
+	enum cpl_program_source source = CPL_PROGRAM_COMPILED;
+	FILE *f;
+
+	if (!program_binary_funcs(&get, &load))
+		return CPL_PROGRAM_UNCACHEABLE;
+	glGetProgramiv(q->program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return CPL_PROGRAM_UNCACHEABLE;
+	if ((binary = malloc(length)) == NULL)
+		return CPL_PROGRAM_COMPILED;
+	get(q->program, length, &h.length, &h.format, binary);
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	f = fopen(tmp, "wb");
+	if (f == NULL)
+		perror(tmp);
+	else {
+		bool written = h.length > 0 && fwrite(&h, sizeof(h), 1, f) == 1 &&
+			       fwrite(binary, h.length, 1, f) == 1;
+
+		if (fclose(f) == 0 && written && rename(tmp, path) == 0)
+			source = CPL_PROGRAM_CACHED;
+		else
+			remove(tmp);
+	}
+	free(binary);
+	return source;
+}
+
+int cpl_quad_init(struct cpl_quad *q, const char *fragment_src)
+{
+	return cpl_quad_init_cached(q, fragment_src, NULL, NULL);
+}
+
+int cpl_quad_init_cached(struct cpl_quad *q, const char *fragment_src, const char *cache_dir,
+			 enum cpl_program_source *source)
+{
+	enum cpl_program_source from = CPL_PROGRAM_COMPILED;
+	char path[512];
+	bool hit = false;
+
+	memset(q, 0, sizeof(*q));
+	if (fragment_src == NULL)
+		fragment_src = cpl_fragment_src;
+
+	if (cache_dir) {
+		cache_path(path, sizeof(path), cache_dir, fragment_src);
+		hit = load_program_binary(q, path);
+	}
+	if (!hit) {
+		if (link_program(q, fragment_src, cache_dir != NULL) < 0)
+			return -1;
+		if (cache_dir)
+			from = save_program_binary(q, path);
+	} else
+		from = CPL_PROGRAM_LOADED;
+	if (source)
+		*source = from;
+	glUseProgram(q->program);
+
+	q->position_loc = glGetAttribLocation(q->program, "a_position");
+	if (q->position_loc < 0) {
+		fprintf(stderr, "Unable to get position location\n");
+		return -1;
+	}
+	q->texture_loc = glGetAttribLocation(q->program, "a_texCoord");
+	if (q->texture_loc < 0) {
+		fprintf(stderr, "Unable to get texture location\n");
+		return -1;
+	}
+	q->sampler_loc = glGetUniformLocation(q->program, "s_texture");
+	if (q->sampler_loc < 0) {
+		fprintf(stderr, "Unable to get sampler location\n");
+		return -1;
+	}
+	return 0;
+}
+
+void cpl_quad_draw(const struct cpl_quad *q, const GLfloat *vertices, GLuint texture)
+{
+	glUseProgram(q->program);
+
+	glVertexAttribPointer(q->position_loc, 3, GL_FLOAT, GL_FALSE,
+			      5 * sizeof (GLfloat), vertices);
+	glEnableVertexAttribArray(q->position_loc);
+
+	glVertexAttribPointer(q->texture_loc, 2, GL_FLOAT, GL_FALSE,
+			      5 * sizeof (GLfloat), vertices + 3);
+	glEnableVertexAttribArray(q->texture_loc);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glUniform1i(q->sampler_loc, 0);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 5);
+}
+
+void cpl_quad_fini(struct cpl_quad *q)
+{
+	glDeleteProgram(q->program);
+	q->program = 0;
+}
+
+int cpl_measure(struct cpl_upload *u, const struct cpl_quad *q, const GLfloat *vertices,
+		const GLubyte *const *frames, int num_frames, double seconds,
+		struct cpl_result *r)
+{
+	double start, t1, t2;
+
+	memset(r, 0, sizeof(*r));
+	if (num_frames < 1 || seconds <= 0.)
+		return -1;
+	if (vertices == NULL)
+		vertices = quad_vertices;
+	// only our own errors count
+	while (glGetError() != GL_NO_ERROR)
+		;
+
+	start = now();
+	do {
+		t1 = now();
+		cpl_upload_frame(u, frames[r->frames % num_frames]);
+		t2 = now();
+		r->upload_time += t2 - t1;
+		r->upload_bytes += u->width * u->height * 4.;
+
+		if (q)
+			cpl_quad_draw(q, vertices, u->texture);
+		glFlush();
+		r->frames++;
+	} while (t2 - start < seconds);
+
+	// nothing counts until the GPU is done with it
+	glFinish();
+	r->elapsed = now() - start;
+
+	if (glGetError() != GL_NO_ERROR) {
+		fprintf(stderr, "GL error while measuring upload path %s\n", u->strategy->name);
+		return -1;
+	}
+	return 0;
+}
+
+double cpl_upload_rate(const struct cpl_result *r)
+{
+	return r->elapsed > 0. ? r->upload_bytes / (r->elapsed * 1024. * 1024.) : 0.;
+}
+
+double cpl_upload_call_rate(const struct cpl_result *r)
+{
+	return r->upload_time > 0. ? r->upload_bytes / (r->upload_time * 1024. * 1024.) : 0.;
+}
+
+#define MAX_CANDIDATES 64
+#define MIN_MEASURE 0.05
+
+struct candidate {
+	struct cpl_upload_config config;
+	double rate;
+};
+
+static int compare_candidates(const void *a, const void *b)
+{
+	const struct candidate *x = a, *y = b;
+
+	return x->rate < y->rate ? 1 : x->rate > y->rate ? -1 : 0;
+}
+
+int cpl_autotune(const struct cpl_quad *q, int width, int height, int stride,
+		 const GLubyte *const *frames, int num_frames, double budget,
+		 bool verbose, struct cpl_profile *best)
+{
+	struct cpl_upload_config configs[MAX_CANDIDATES];
+	struct candidate c[MAX_CANDIDATES];
+	const char *renderer;
+	double start = now(), need;
+	int n, m, alive, full, rounds, round, k;
+
+	n = cpl_upload_configs(width, height, stride, configs, MAX_CANDIDATES);
+	if (n == 0)
+		return -1;
+
+	// every measurement needs MIN_MEASURE, when the budget cannot give
+	// that to all of them keep an even spread across the strategies
+	m = budget / MIN_MEASURE;
+	if (m < 1)
+		m = 1;
+	if (m > n)
+		m = n;
+	if (m < n && verbose)
+		printf("autotune: %.2f s budget measures %d of %d candidates, %.2f s tries all\n",
+		       budget, m, n, n * MIN_MEASURE);
+	for (k = 0; k < m; k++)
+		c[k].config = configs[k * n / m];
+
+	// only the rounds that fit at MIN_MEASURE per candidate, the first
+	// always runs
+	for (full = 1; (1 << full) < m; full++)
+		;
+	need = m * MIN_MEASURE;
+	for (rounds = 1, alive = (m + 1) / 2; rounds < full; rounds++, alive = (alive + 1) / 2) {
+		need += alive * MIN_MEASURE;
+		if (need > budget)
+			break;
+	}
+
+	alive = m;
+	for (round = 0; round < rounds; round++) {
+		// setup and the final glFinish count against the budget too
+		double left = budget - (now() - start);
+		double t = left / (rounds - round) / alive;
+
+		// late in the budget only the fastest so far fit in this round
+		if (round > 0 && left < alive * MIN_MEASURE) {
+			alive = left / MIN_MEASURE;
+			if (alive < 2)
+				break;
+			t = left / alive;
+		}
+		if (t < MIN_MEASURE)
+			t = MIN_MEASURE;
+		if (verbose)
+			printf("autotune round %d: %d candidates, %.2f s each\n", round + 1, alive, t);
+
+		for (k = 0; k < alive; k++) {
+			struct cpl_upload u;
+			struct cpl_result r;
+
+			c[k].rate = 0.;
+			if (cpl_upload_init(&u, c[k].config.strategy, width, height, stride,
+					    c[k].config.alignment, c[k].config.pbo_depth) < 0)
+				continue;
+			if (c[k].config.copy)
+				u.copy = c[k].config.copy;
+			if (cpl_measure(&u, q, NULL, frames, num_frames, t, &r) == 0)
+				c[k].rate = cpl_upload_rate(&r);
+			cpl_upload_fini(&u);
+
+			if (verbose) {
+				printf("  %-12s alignment %d", c[k].config.strategy->name, c[k].config.alignment);
+				if (c[k].config.pbo_depth)
+					printf(", %d buffers", c[k].config.pbo_depth);
+				if (c[k].config.copy)
+					printf(", %s", c[k].config.copy->name);
+				printf(": %f MiB/s\n", c[k].rate);
+			}
+		}
+
+		qsort(c, alive, sizeof(c[0]), compare_candidates);
+		alive = (alive + 1) / 2;
+	}
+
+	if (c[0].rate <= 0.)
+		return -1;
+
+	memset(best, 0, sizeof(*best));
+	best->strategy = c[0].config.strategy;
+	best->alignment = c[0].config.alignment;
+	best->pbo_depth = c[0].config.pbo_depth;
+	best->copy = c[0].config.copy;
+	best->width = width;
+	best->height = height;
+	best->stride = stride;
+	best->rate = c[0].rate;
+	renderer = (const char *)glGetString(GL_RENDERER);
+	if (renderer)
+		snprintf(best->renderer, sizeof(best->renderer), "%s", renderer);
+	return 0;
+}
+
+int cpl_write_profile(const char *path, const struct cpl_profile *p)
+{
+	FILE *f = fopen(path, "w");
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "# cpulinear upload profile\n");
+	fprintf(f, "renderer=%s\n", p->renderer);
+	fprintf(f, "width=%d\n", p->width);
+	fprintf(f, "height=%d\n", p->height);
+	fprintf(f, "stride=%d\n", p->stride);
+	fprintf(f, "upload_path=%s\n", p->strategy->name);
+	fprintf(f, "unpack_alignment=%d\n", p->alignment);
+	fprintf(f, "pbo_depth=%d\n", p->pbo_depth);
+	if (p->copy)
+		fprintf(f, "copy_kernel=%s\n", p->copy->name);
+	fprintf(f, "rate=%f\n", p->rate);
+	if (fclose(f) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+int cpl_read_profile(const char *path, struct cpl_profile *p)
+{
+	const char *renderer = (const char *)glGetString(GL_RENDERER);
+	char line[256];
+	char copy[64] = "";
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	memset(p, 0, sizeof(*p));
+	while (fgets(line, sizeof(line), f)) {
+		char *value = strchr(line, '=');
+
+		if (line[0] == '#' || value == NULL)
+			continue;
+		*value++ = '\0';
+		value[strcspn(value, "\n")] = '\0';
+
+		if (strcmp(line, "renderer") == 0)
+			snprintf(p->renderer, sizeof(p->renderer), "%s", value);
+		else if (strcmp(line, "width") == 0)
+			p->width = atoi(value);
+		else if (strcmp(line, "height") == 0)
+			p->height = atoi(value);
+		else if (strcmp(line, "stride") == 0)
+			p->stride = atoi(value);
+		else if (strcmp(line, "upload_path") == 0)
+			p->strategy = cpl_find_upload_strategy(value);
+		else if (strcmp(line, "unpack_alignment") == 0)
+			p->alignment = atoi(value);
+		else if (strcmp(line, "pbo_depth") == 0)
+			p->pbo_depth = atoi(value);
+		else if (strcmp(line, "copy_kernel") == 0)
+			snprintf(copy, sizeof(copy), "%s", value);
+		else if (strcmp(line, "rate") == 0)
+			p->rate = atof(value);
+	}
+	fclose(f);
+
+	if (p->strategy == NULL || p->alignment < 1) {
+		fprintf(stderr, "%s: no usable upload path in profile\n", path);
+		return -1;
+	}
+	if (copy[0]) {
+		p->copy = cpl_find_copy_kernel(copy);
+		if (p->copy == NULL || !p->copy->supported()) {
+			fprintf(stderr, "%s: copy kernel %s not available on this CPU\n", path, copy);
+			return -1;
+		}
+	}
+	if (renderer && strncmp(renderer, p->renderer, sizeof(p->renderer) - 1) != 0) {
+		fprintf(stderr, "%s: profile is for %s, not %s\n", path, p->renderer, renderer);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+// libcpulinear: the texture upload and draw measurements of cpulinear, for
+// applications that want to pick their upload path at startup.
+//
+// Everything runs on the EGL/GLES context that is current in the calling
+// thread, the library never creates one.  Functions returning int return 0
+// on success and -1 with a message on stderr otherwise.
+
+#ifndef LIBCPULINEAR_H
+#define LIBCPULINEAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <GLES2/gl2.h>
+
+struct cpl_upload;
+
+// a way of copying frame data into staging memory, which may be a mapped
+// buffer that is uncached or write-combined
+struct cpl_copy_kernel {
+	const char *name;
+	// whether the CPU running us has the instructions it needs
+	bool (*supported)(void);
+	void (*copy)(void *dst, const void *src, size_t len);
+};
+
+// memcpy first, the rest depend on the architecture, NULL name terminated
+extern const struct cpl_copy_kernel cpl_copy_kernels[];
+
+// one way of getting RGBA frames from memory into a texture
+struct cpl_upload_strategy {
+	const char *name;
+	// whether the current context can take frames of this layout
+	bool (*supported)(const struct cpl_upload *u);
+	// called with the texture bound, may allocate storage and buffers
+	int (*init)(struct cpl_upload *u);
+	void (*upload)(struct cpl_upload *u, const GLubyte *data);
+	void (*fini)(struct cpl_upload *u);
+};
+
+extern const struct cpl_upload_strategy cpl_upload_teximage;    // glTexImage2D, stride implied by the alignment
+extern const struct cpl_upload_strategy cpl_upload_row_length;  // glTexImage2D with GLES3 GL_UNPACK_ROW_LENGTH
+extern const struct cpl_upload_strategy cpl_upload_repack;      // tightly packed copy on the CPU first
+extern const struct cpl_upload_strategy cpl_upload_texsubimage; // glTexSubImage2D into allocated storage
+extern const struct cpl_upload_strategy cpl_upload_pbo;         // GLES3 pixel unpack buffer ring
+
+// all of the above, NULL terminated
+extern const struct cpl_upload_strategy *const cpl_upload_strategies[];
+
+struct cpl_upload {
+	const struct cpl_upload_strategy *strategy;
+	int width;
+	int height;
+	int stride;             // bytes between source rows, a multiple of 4
+	int alignment;          // GL_UNPACK_ALIGNMENT: 1, 2, 4 or 8
+	int gles_version;
+	GLuint texture;
+
+	// strategy state
+	GLubyte *repack_buf;
+	GLuint *pbos;
+	int pbo_depth;
+	int pbo_next;
+	const struct cpl_copy_kernel *copy; // staging copy of repack and pbo, memcpy by default
+};
+
+// one point of the space cpl_autotune() searches
+struct cpl_upload_config {
+	const struct cpl_upload_strategy *strategy;
+	int alignment;
+	int pbo_depth;
+	const struct cpl_copy_kernel *copy;
+};
+
+// a program drawing one texture over the whole viewport
+struct cpl_quad {
+	GLuint program;
+	GLint position_loc;
+	GLint texture_loc;
+	GLint sampler_loc;
+};
+
+struct cpl_result {
+	unsigned long long frames;
+	double elapsed;         // wall clock, including the final glFinish
+	double upload_time;     // spent inside the upload calls
+	double upload_bytes;
+};
+
+// the fastest upload configuration found for a device and frame layout
+struct cpl_profile {
+	const struct cpl_upload_strategy *strategy;
+	int alignment;
+	int pbo_depth;
+	const struct cpl_copy_kernel *copy;
+	int width;
+	int height;
+	int stride;
+	double rate;            // MiB/s over the wall clock
+	char renderer[128];     // GL_RENDERER it was measured on
+};
+
+extern const char cpl_vertex_src[];
+extern const char cpl_fragment_src[];
+
+// major version of the current context
+int cpl_gles_version(void);
+
+const struct cpl_upload_strategy *cpl_find_upload_strategy(const char *name);
+const struct cpl_copy_kernel *cpl_find_copy_kernel(const char *name);
+
+// MiB/s of copying bytes from src with k for the given time, into a mapped
+// GLES3 pixel unpack buffer or, with mapped false, into malloc'ed memory;
+// 0 if the destination could not be had
+double cpl_copy_rate(const struct cpl_copy_kernel *k, const GLubyte *src, size_t bytes,
+		     bool mapped, double seconds);
+
+// every strategy, alignment, pbo depth and, for the strategies that stage
+// frames, copy kernel the current context can use for frames of this
+// layout, returns how many were stored
+int cpl_upload_configs(int width, int height, int stride,
+		       struct cpl_upload_config *configs, int max);
+
+// creates u->texture and leaves it bound, pbo_depth of 0 means the default
+int cpl_upload_init(struct cpl_upload *u, const struct cpl_upload_strategy *strategy,
+		    int width, int height, int stride, int alignment, int pbo_depth);
+void cpl_upload_frame(struct cpl_upload *u, const GLubyte *data);
+void cpl_upload_fini(struct cpl_upload *u);
+
+// returns 0 on compile errors, after printing the log
+GLuint cpl_load_shader(const char *source, GLenum type);
+
+// fragment_src samples s_texture at v_texCoord, NULL for cpl_fragment_src
+int cpl_quad_init(struct cpl_quad *q, const char *fragment_src);
+// where cpl_quad_init_cached() got its program from
+enum cpl_program_source {
+	CPL_PROGRAM_COMPILED,           // no cache, or the binary could not be written
+	CPL_PROGRAM_CACHED,             // compiled and saved to the cache
+	CPL_PROGRAM_LOADED,             // loaded from the cache
+	CPL_PROGRAM_UNCACHEABLE,        // compiled, the driver gives out no binaries
+};
+
+// the same, loading the linked program from a binary in cache_dir when
+// one exists for this driver and these sources, and saving it there after
+// compiling otherwise; needs GLES3 or OES_get_program_binary to cache
+int cpl_quad_init_cached(struct cpl_quad *q, const char *fragment_src, const char *cache_dir,
+			 enum cpl_program_source *source);
+// vertices: five interleaved x, y, z, u, v vertices of a triangle strip
+void cpl_quad_draw(const struct cpl_quad *q, const GLfloat *vertices, GLuint texture);
+void cpl_quad_fini(struct cpl_quad *q);
+
+// uploads frames[] in turn for the given time, drawing each one when q is
+// not NULL; vertices NULL means the unrotated full viewport quad
+int cpl_measure(struct cpl_upload *u, const struct cpl_quad *q, const GLfloat *vertices,
+		const GLubyte *const *frames, int num_frames, double seconds,
+		struct cpl_result *r);
+
+// MiB/s over the wall clock and over the upload calls alone
+double cpl_upload_rate(const struct cpl_result *r);
+double cpl_upload_call_rate(const struct cpl_result *r);
+
+// tries every supported strategy, alignment and pbo depth for frames of
+// the given layout within budget seconds, dropping the slower half after
+// each round (successive halving); verbose prints every round.  Each
+// candidate needs 0.05 s, smaller budgets stop halving early and below
+// 0.05 s per candidate only an even spread of them is measured
+int cpl_autotune(const struct cpl_quad *q, int width, int height, int stride,
+		 const GLubyte *const *frames, int num_frames, double budget,
+		 bool verbose, struct cpl_profile *best);
+
+// a small key=value text file; reading fails if the file was written for
+// another renderer than the current context's
+int cpl_write_profile(const char *path, const struct cpl_profile *p);
+int cpl_read_profile(const char *path, struct cpl_profile *p);
+
+#endif